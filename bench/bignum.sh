@@ -0,0 +1,30 @@
+#!/bin/bash
+# Bignums printed back in decimal, prints FAIL with both lengths on a mismatch.
+# Usage: bench/bignum.sh [path to blisp.out]
+BLISP=${1:-./blisp.out}
+TMP=$(mktemp -d)
+
+# n copies of the digit d
+digits(){
+    printf "%*s" $2 "" | tr " " $1
+}
+
+check(){
+    echo "(print $2)" > $TMP/check.blsp
+    got=$($BLISP $TMP/check.blsp 2>&1 | tail -n 1)
+    if [ "$got" == "$3 " ]; then
+        echo "ok $1"
+    else
+        echo "FAIL $1, got ${#got} characters, expected $(( ${#3} + 1 ))"
+    fi
+}
+
+for n in 700 5000 20000; do
+    check "10^$n" "(* 1 1$(digits 0 $n))" "1$(digits 0 $n)"
+done
+check "10^5000 - 1" "(- 1$(digits 0 5000) 1)" "$(digits 9 5000)"
+check "-10^5000" "(- 0 1$(digits 0 5000))" "-1$(digits 0 5000)"
+check "zeros between" "(+ 1 7$(digits 0 3000))" "7$(digits 0 2999)1"
+check "zeros below" "(* 123 1$(digits 0 12000))" "123$(digits 0 12000)"
+
+rm -r $TMP
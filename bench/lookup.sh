@@ -0,0 +1,33 @@
+#!/bin/bash
+# Global lookup cost against the size of the global enviorment.
+# Usage: bench/lookup.sh [path to blisp.out]
+BLISP=${1:-./blisp.out}
+TIMEFORMAT="%U"
+TMP=$(mktemp -d)
+
+for n in 10 100 1000 10000; do
+    # n global definitions
+    for ((i = 0; i < n; i++)); do
+        echo "(def {g$i} $i)"
+    done > $TMP/defs.blsp
+    
+    # The same plus 20 lookups of every 5th global per iteration
+    syms=""
+    for ((i = 0; i < 20; i++)); do
+        syms="$syms g$((i * n / 20))"
+    done
+    cp $TMP/defs.blsp $TMP/look.blsp
+    cat >> $TMP/look.blsp <<BLSP
+(def {fun} (\\ {args body} {def (head args) (\\ (tail args) body)}))
+(fun {look k} {if (== k 0) {0} {do (+ $syms) (look (- k 1))}})
+(fun {do a b} {b})
+(fun {times n} {if (== n 0) {0} {do (look 200) (times (- n 1))}})
+(times 100)
+BLSP
+    
+    defs=$( { time $BLISP $TMP/defs.blsp > /dev/null; } 2>&1 )
+    look=$( { time $BLISP $TMP/look.blsp > /dev/null; } 2>&1 )
+    echo "$n globals: ${defs}s defining, ${look}s with 400000 lookups"
+done
+
+rm -r $TMP
@@ -0,0 +1,24 @@
+#!/bin/bash
+# Matrix multiply cost against the size of the matrices.
+# Usage: bench/matmul.sh [path to blisp.out]
+BLISP=${1:-./blisp.out}
+TIMEFORMAT="%U"
+TMP=$(mktemp -d)
+
+for n in 64 128 256 512 1024; do
+    # Two n by n matrices, about 2^30 multiply-adds worth of products
+    reps=$(( (1 << 30) / (n * n * n) ))
+    cat > $TMP/setup.blsp <<BLSP
+(def {a} (reshape (/ (vec-range $((n * n))) $((n * n))) $n $n))
+(def {b} (- 1 (transpose a)))
+BLSP
+
+    cp $TMP/setup.blsp $TMP/mul.blsp
+    echo "(dotimes {i $reps} (matmul a b))" >> $TMP/mul.blsp
+
+    setup=$( { time $BLISP $TMP/setup.blsp > /dev/null; } 2>&1 )
+    mul=$( { time $BLISP $TMP/mul.blsp > /dev/null; } 2>&1 )
+    echo "${n}x${n}: ${setup}s setup, ${mul}s with $reps multiplies"
+done
+
+rm -r $TMP
@@ -1,6 +1,8 @@
 
 #include "mpc.h"
 #include "blisp.h"
+#include <time.h>
+#include <limits.h>
 /* Use these in Windows*/
 #ifdef _WIN32
 
@@ -26,15 +28,24 @@ void add_history(char* unused){}
 #else
 
 #include <editline/readline.h>
+#include <sys/resource.h>
 
 #endif
 
 /* Enumeration for possible lval types */
-enum { LVAL_ERR, LVAL_NUM, LVAL_SYM, LVAL_STR, LVAL_DBL, LVAL_SEXPR, LVAL_QEXPR, LVAL_FUN };
+enum { LVAL_ERR, LVAL_NUM, LVAL_SYM, LVAL_STR, LVAL_DBL, LVAL_SEXPR, LVAL_QEXPR, LVAL_FUN, LVAL_FORM, LVAL_BIG, LVAL_VEC, LVAL_MAT };
 
 /* Enumeration for possible error types */
 enum { LERR_DIV_ZERO, LERR_BAD_OP, LERR_BAD_NUM };
 
+/* Operators of the arithmetic and comparison builtins */
+enum { LPRIM_ADD, LPRIM_SUB, LPRIM_MUL, LPRIM_DIV,
+       LPRIM_LT, LPRIM_GT, LPRIM_LTE, LPRIM_GTE, LPRIM_EQ, LPRIM_NE, LPRIM_COUNT };
+
+static char* lprim_names[LPRIM_COUNT] = {
+    "+", "-", "*", "/", "<", ">", "<=", ">=", "==", "!="
+};
+
 
 /*
  ** Define Language
@@ -66,1046 +77,5006 @@ void define_lang(void){
     
 }
 /*
- ** Enviorment Functions
+ ** Allocator Functions
+ **
+ ** lvals, enviorments and small cell buffers come from per size class
+ ** free lists.
+ ** Build with -DBLISP_NO_SLAB to fall back to malloc, e.g. for sanitizers.
  */
-lenv* lenv_new(void){
-    lenv* e = malloc(sizeof(lenv));
-    e->par = NULL;
-    e->count = 0;
-    e->syms = NULL;
-    e->vals = NULL;
-    return e;
+#define LSLAB_CHUNK 16384
+
+lalloc* lalloc_new(void){
+    lalloc* a = calloc(1, sizeof(lalloc));
+    a->lvals.size = sizeof(lval);
+    a->envs.size = sizeof(lenv);
+    for(int i = 0; i < LSLAB_CELL_CLASSES; i++){
+        a->cells[i].size = sizeof(lcells) + sizeof(lval*) * ((2 << i) - 1);
+    }
+    return a;
 }
 
-void lenv_del(lenv* e){
-    for(int i = 0; i < e->count; i++){
-        free(e->syms[i]);
-        lval_del(e->vals[i]);
+static void lslab_release(lslab* s){
+    while(s->chunks){
+        void* next = *(void**)s->chunks;
+        free(s->chunks);
+        s->chunks = next;
     }
-    
-    free(e->syms);
-    free(e->vals);
-    free(e);
+    s->free = NULL;
 }
 
-lval* lenv_get(lenv* e, lval* k){
-    
-    /* Find key in array */
-    for(int i = 0; i < e->count; i++){
-        if(strcmp(e->syms[i], k->sym) == 0) {
-            return lval_copy(e->vals[i]);
-        }
+void lalloc_del(lalloc* a){
+    lslab_release(&a->lvals);
+    lslab_release(&a->envs);
+    for(int i = 0; i < LSLAB_CELL_CLASSES; i++){
+        lslab_release(&a->cells[i]);
     }
-    
-    if(e->par) {
-        return lenv_get(e->par, k);
-    } else {
-        return lval_err("ERROR: Unbound Symbol '%s'", k->sym);
+    free(a);
+}
+
+#ifndef BLISP_NO_SLAB
+/* Carve a fresh chunk into free objects, the first word links the chunks */
+static void lslab_refill(lslab* s){
+    char* chunk = malloc(LSLAB_CHUNK);
+    *(void**)chunk = s->chunks;
+    s->chunks = chunk;
+    
+    for(size_t off = s->size; off + s->size <= LSLAB_CHUNK; off += s->size){
+        *(void**)(chunk + off) = s->free;
+        s->free = chunk + off;
     }
 }
+#endif
 
-void lenv_put(lenv* e, lval* k, lval* v){
-    
-    /* Check if variable alredy been defined */
-    for(int i = 0; i < e->count; i++){
-        
-        /* if variables is found
-         ** delete the previous value and assign the new */
-        if(strcmp(e->syms[i], k->sym) == 0){
-            lval_del(e->vals[i]);
-            e->vals[i] = lval_copy(v);
-            return;
-        }
+void* lslab_alloc(lslab* s){
+#ifdef BLISP_NO_SLAB
+    s->misses++;
+    return malloc(s->size);
+#else
+    if(s->free){
+        s->hits++;
+    } else {
+        s->misses++;
+        lslab_refill(s);
     }
     
-    e->count++;
-    e->vals = realloc(e->vals, sizeof(lval*) * e->count);
-    e->syms = realloc(e->syms, sizeof(char*) * e->count);
-    
-    /* Copy content */
-    e->vals[e->count-1] = lval_copy(v);
-    e->syms[e->count-1] = malloc(strlen(k->sym)+1);
-    strcpy(e->syms[e->count-1], k->sym);
+    void* p = s->free;
+    s->free = *(void**)p;
+    return p;
+#endif
 }
 
-void lenv_def(lenv* e, lval* k, lval* v){
-    
-    while(e->par) {
-        e = e->par;
+void lslab_free(lslab* s, void* p){
+#ifdef BLISP_NO_SLAB
+    free(p);
+#else
+    *(void**)p = s->free;
+    s->free = p;
+#endif
+}
+
+/* Size class of a buffer with cap slots, -1 if it is too big for the slabs */
+static int lcells_class(int cap){
+    int c = 0;
+    while((2 << c) - 1 < cap){
+        c++;
     }
-    
-    lenv_put(e, k, v);
+    return c < LSLAB_CELL_CLASSES ? c : -1;
 }
 
-lenv* lenv_copy(lenv* e){
-    lenv* n = malloc(sizeof(lenv));
+/* New unshared cell buffer with room for at least n slots, capacities
+ ** grow as 2^k - 1 so the header and the slots fill a power of two */
+lcells* lcells_new(int n){
+    int cap = 1;
+    while(cap < n){
+        cap = cap * 2 + 1;
+    }
     
-    n->par = e->par;
-    n->count = e->count;
-    n->syms = malloc(sizeof(char*) * n->count);
-    n->vals = malloc(sizeof(lval*) * n->count);
-    for(int i = 0; i < n->count; i++){
-        n->syms[i] = malloc(strlen(e->syms[i] + 1));
-        strcpy(n->syms[i], e->syms[i]);
-        n->vals[i] = lval_copy(e->vals[i]);
+    int c = lcells_class(cap);
+    lcells* b = NULL;
+    if(c >= 0){
+        b = lslab_alloc(&Alloc->cells[c]);
+    } else {
+        b = malloc(sizeof(lcells) + sizeof(lval*) * cap);
     }
     
-    return n;
+    b->refs = 1;
+    b->cap = cap;
+    return b;
 }
 
-
+/* Drop a reference to b, freeing it with the last one */
+void lcells_release(lcells* b){
+    if(!b || --b->refs > 0){
+        return;
+    }
+    
+    int c = lcells_class(b->cap);
+    if(c >= 0){
+        lslab_free(&Alloc->cells[c], b);
+    } else {
+        free(b);
+    }
+}
 
 /*
- ** LVAL Functions
+ ** Bignum Functions
+ **
+ ** Integers beyond int64 are lbigs, a sign and a magnitude of base 2^32
+ ** limbs, least significant first and without leading zero limbs. Limb
+ ** arrays small enough share the cell buffer slabs.
+ **
+ ** Products are schoolbook below LBIG_KARATSUBA limbs and Karatsuba
+ ** above. Quotients use Knuth's algorithm D, or for divisors and
+ ** quotients of LBIG_NEWTON limbs and more a reciprocal from Newton's
+ ** method, so a division costs a few products. Decimal conversion splits
+ ** the number at powers of 10^9, which keeps reading and printing
+ ** sub-quadratic as well.
  */
+#define LBIG_KARATSUBA 32
+#define LBIG_NEWTON 64
 
-/* Create a new lval type num*/
-lval* lval_num(double x, int type){
-    lval* v = malloc(sizeof(lval));
-    v->type = type;
-    v->num = x;
-    return v;
+/* Limbs converted to and from decimal nine digits at a time */
+#define LBIG_DECIMAL 64
+
+/* Size class of the cell slabs holding size bytes, -1 if none does */
+static int lslab_class(size_t size){
+    for(int c = 0; c < LSLAB_CELL_CLASSES; c++){
+        if(Alloc->cells[c].size >= size){
+            return c;
+        }
+    }
+    return -1;
 }
 
+/* New zero with room for n limbs */
+lbig* lbig_new(int n){
+    int c = lslab_class(sizeof(lbig) + sizeof(uint32_t) * n);
+    lbig* b = NULL;
+    if(c >= 0){
+        b = lslab_alloc(&Alloc->cells[c]);
+        b->cap = (int)((Alloc->cells[c].size - sizeof(lbig)) / sizeof(uint32_t));
+    } else {
+        b = malloc(sizeof(lbig) + sizeof(uint32_t) * n);
+        b->cap = n;
+    }
 
-lval* lval_sym(char* s){
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_SYM;
-    v->sym = malloc(strlen(s) + 1);
-    strcpy(v->sym, s);
-    return v;
+    b->sign = 1;
+    b->count = 0;
+    return b;
 }
 
-lval* lval_sexpr(void){
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_SEXPR;
-    v->count = 0;
-    v->cell = NULL;
-    return v;
+void lbig_del(lbig* b){
+    int c = lslab_class(sizeof(lbig) + sizeof(uint32_t) * b->cap);
+    if(c >= 0){
+        lslab_free(&Alloc->cells[c], b);
+    } else {
+        free(b);
+    }
 }
 
-lval* lval_qexpr(void){
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_QEXPR;
-    v->count = 0;
-    v->cell = NULL;
-    return v;
+/* Limbs of the n limbs at a without the leading zeros */
+static int lmag_trim(const uint32_t* a, int n){
+    while(n > 0 && a[n-1] == 0){
+        n--;
+    }
+    return n;
 }
 
-lval* lval_fun(lbuiltin func){
-    lval* v= malloc(sizeof(lval));
-    v->type = LVAL_FUN;
-    v->builtin = func;
-    return v;
+static int lmag_cmp(const uint32_t* a, int na, const uint32_t* b, int nb){
+    if(na != nb){
+        return na < nb ? -1 : 1;
+    }
+    for(int i = na - 1; i >= 0; i--){
+        if(a[i] != b[i]){
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+    return 0;
 }
 
-/* Create a new lval type error*/
-lval* lval_err(char* fmt, ...){
-    
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_ERR;
-    
-    va_list va;
-    
-    va_start(va, fmt);
-    
-    /* Allocate space */
-    v->err = malloc(512);
-    
-    vsnprintf(v->err, 511, fmt, va);
-    
-    v->err = realloc(v->err, strlen(v->err)+1);
-    
-    va_end(va);
-    
-    return v;
+/* r = a + b for na >= nb, r has room for na + 1 limbs and may be a.
+ ** Returns the limbs of r */
+static int lmag_add(uint32_t* r, const uint32_t* a, int na, const uint32_t* b, int nb){
+    uint64_t c = 0;
+    int i = 0;
+    for(; i < nb; i++){
+        c += (uint64_t)a[i] + b[i];
+        r[i] = (uint32_t)c;
+        c >>= 32;
+    }
+    for(; i < na; i++){
+        c += a[i];
+        r[i] = (uint32_t)c;
+        c >>= 32;
+    }
+    r[na] = (uint32_t)c;
+    return lmag_trim(r, na + 1);
 }
 
-lval* lval_str(char* s){
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_STR;
-    v->str = malloc(strlen(s) + 1);
-    strcpy(v->str, s);
-    return v;
+/* r = a - b for a >= b, r may be a. Returns the limbs of r */
+static int lmag_sub(uint32_t* r, const uint32_t* a, int na, const uint32_t* b, int nb){
+    uint64_t borrow = 0;
+    int i = 0;
+    for(; i < nb; i++){
+        uint64_t t = (uint64_t)a[i] - b[i] - borrow;
+        r[i] = (uint32_t)t;
+        borrow = (t >> 32) & 1;
+    }
+    for(; i < na; i++){
+        uint64_t t = (uint64_t)a[i] - borrow;
+        r[i] = (uint32_t)t;
+        borrow = (t >> 32) & 1;
+    }
+    return lmag_trim(r, na);
 }
 
-lval* lval_lambda(lval* formals, lval* body){
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
-    
-    /* Set builtin to NULL */
-    v->builtin = NULL;
-    
-    /* Build new enviorment */
-    v->env = lenv_new();
-    
-    /* Set Formals and body */
-    v->formals = formals;
-    v->body = body;
-    
-    return v;
-    
+/* r += a in place, the sum fits the nr limbs of r */
+static void lmag_addto(uint32_t* r, int nr, const uint32_t* a, int na){
+    uint64_t c = 0;
+    int i = 0;
+    for(; i < na; i++){
+        c += (uint64_t)r[i] + a[i];
+        r[i] = (uint32_t)c;
+        c >>= 32;
+    }
+    for(; c && i < nr; i++){
+        c += r[i];
+        r[i] = (uint32_t)c;
+        c >>= 32;
+    }
 }
 
-/* Delete lval and free memory */
-void lval_del(lval* v){
-    
-    switch(v->type){
-        case LVAL_NUM:
-            break;
-        case LVAL_ERR:
-            free(v->err);
-            break;
-        case LVAL_SYM:
-            free(v->sym);
-            break;
-        case LVAL_QEXPR:
-        case LVAL_SEXPR:
-            for(int i = 0; i < v->count; i++){
-                lval_del(v->cell[i]);
-            }
-            
-            free(v->cell);
-            break;
-        case LVAL_FUN:
-            if(!v->builtin){
-                lenv_del(v->env);
-                lval_del(v->formals);
-                lval_del(v->body);
-            }
-            break;
-        case LVAL_STR:
-            if(v->str){
-                free(v->str);
-            }
-            break;
+/* r = a * b, r has room for na + nb limbs apart from a and b */
+static void lmag_mul(uint32_t* r, const uint32_t* a, int na, const uint32_t* b, int nb){
+    if(na < nb){
+        const uint32_t* t = a; a = b; b = t;
+        int n = na; na = nb; nb = n;
     }
-    
-    free(v);
-}
 
-lval* lval_copy(lval* v){
-    
-    lval* x = malloc(sizeof(lval));
-    x->type = v->type;
-    
-    switch(v->type){
-            
-        case LVAL_FUN:
-            if(v->builtin){
-                x->builtin = v->builtin;
-            } else {
-                x->builtin = NULL;
-                x->env = lenv_copy(v->env);
-                x->formals = lval_copy(v->formals);
-                x->body = lval_copy(v->body);
-            }
-            break;
-        case LVAL_NUM:
-            x->num = v->num;
-            break;
-        case LVAL_ERR:
-            x->err = malloc(strlen(v->err) + 1);
-            strcpy(x->err, v->err);
-            break;
-        case LVAL_SYM:
-            x->sym = malloc(strlen(v->sym) + 1);
-            strcpy(x->sym, v->sym);
-            break;
-        case LVAL_QEXPR:
-        case LVAL_SEXPR:
-            x->count = v->count;
-            x->cell = malloc(sizeof(lval*) * x->count);
-            for(int i = 0; i < x->count; i++){
-                x->cell[i] = lval_copy(v->cell[i]);
+    if(nb < LBIG_KARATSUBA){
+        memset(r, 0, sizeof(uint32_t) * (na + nb));
+        for(int i = 0; i < nb; i++){
+            uint64_t c = 0;
+            for(int j = 0; j < na; j++){
+                c += (uint64_t)a[j] * b[i] + r[i+j];
+                r[i+j] = (uint32_t)c;
+                c >>= 32;
             }
-            break;
-        case LVAL_STR:
-            x->str = malloc(strlen(v->str) + 1);
-            strcpy(x->str, v->str);
-            break;
+            r[i+na] = (uint32_t)c;
+        }
+        return;
     }
-    
-    return x;
+
+    if(na >= 2 * nb){
+        /* Unbalanced, multiply b by slices of a as long as b */
+        uint32_t* t = malloc(sizeof(uint32_t) * 2 * nb);
+        memset(r, 0, sizeof(uint32_t) * (na + nb));
+        for(int i = 0; i < na; i += nb){
+            int m = na - i < nb ? na - i : nb;
+            lmag_mul(t, a + i, m, b, nb);
+            lmag_addto(r + i, na + nb - i, t, lmag_trim(t, m + nb));
+        }
+        free(t);
+        return;
+    }
+
+    /* Karatsuba, with a = a1 B^h + a0 and b = b1 B^h + b0 the middle
+     ** product a1 b0 + a0 b1 is (a1 + a0)(b1 + b0) - a1 b1 - a0 b0 */
+    int h = na / 2;
+    int n1 = na - h;
+    int m1 = nb - h;
+    lmag_mul(r, a, h, b, h);
+    lmag_mul(r + 2*h, a + h, n1, b + h, m1);
+
+    int big = m1 > h ? m1 : h;
+    uint32_t* sa = malloc(sizeof(uint32_t) * (n1 + 1 + big + 1 + n1 + big + 2));
+    uint32_t* sb = sa + n1 + 1;
+    uint32_t* t = sb + big + 1;
+    int la = lmag_add(sa, a + h, n1, a, h);
+    int lb = m1 > h ? lmag_add(sb, b + h, m1, b, h) : lmag_add(sb, b, h, b + h, m1);
+    lmag_mul(t, sa, la, sb, lb);
+
+    int lt = lmag_trim(t, la + lb);
+    lt = lmag_sub(t, t, lt, r, lmag_trim(r, 2*h));
+    lt = lmag_sub(t, t, lt, r + 2*h, lmag_trim(r + 2*h, n1 + m1));
+    lmag_addto(r + h, na + nb - h, t, lt);
+    free(sa);
 }
 
-lval* lval_add(lval* v, lval* x){
-    v->count++;
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-    v->cell[v->count - 1] = x;
-    return v;
+/* Divide the n limbs at a by the single limb d in place, returns the
+ ** remainder */
+static uint32_t lmag_divsmall(uint32_t* a, int n, uint32_t d){
+    uint64_t k = 0;
+    for(int i = n - 1; i >= 0; i--){
+        uint64_t t = (k << 32) | a[i];
+        a[i] = (uint32_t)(t / d);
+        k = t % d;
+    }
+    return (uint32_t)k;
 }
 
+/* Leading zero bits of a nonzero limb */
+static int lmag_clz(uint32_t x){
+    int s = 0;
+    while(!(x & 0x80000000u)){
+        x <<= 1;
+        s++;
+    }
+    return s;
+}
 
+/* r = a << s for s < 32, r has room for na + 1 limbs */
+static void lmag_shl(uint32_t* r, const uint32_t* a, int na, int s){
+    r[na] = s ? a[na-1] >> (32 - s) : 0;
+    for(int i = na - 1; i > 0; i--){
+        r[i] = (a[i] << s) | (s ? a[i-1] >> (32 - s) : 0);
+    }
+    r[0] = a[0] << s;
+}
 
-void lval_expr_print(lval* v, char open, char close){
-    putchar(open);
-    
-    for(int i = 0; i < v->count; i++){
-        /* Print value */
-        lval_print(v->cell[i]);
+/* Knuth's algorithm D, q = u / v for a normalized v of nv >= 2 limbs,
+ ** whose top bit is set. u has a spare top limb u[nu], and is left with
+ ** the remainder. q has room for nu - nv + 1 limbs */
+static void lmag_knuth(uint32_t* q, uint32_t* u, int nu, const uint32_t* v, int nv){
+    uint64_t top = v[nv-1];
+    for(int j = nu - nv; j >= 0; j--){
+        /* Estimate the quotient limb from the top two of u */
+        uint64_t num = ((uint64_t)u[j+nv] << 32) | u[j+nv-1];
+        uint64_t qhat = num / top;
+        uint64_t rhat = num % top;
+        while(qhat >> 32 || qhat * v[nv-2] > ((rhat << 32) | u[j+nv-2])){
+            qhat--;
+            rhat += top;
+            if(rhat >> 32){
+                break;
+            }
+        }
         
-        /* Don't print space */
-        if(i != (v->count-1)){
-            putchar(' ');
+        /* Multiply and subtract */
+        uint64_t k = 0;
+        for(int i = 0; i < nv; i++){
+            uint64_t p = qhat * v[i];
+            uint64_t sub = (p & 0xFFFFFFFFu) + k;
+            uint64_t cur = u[i+j];
+            u[i+j] = (uint32_t)(cur - sub);
+            k = (p >> 32) + (sub > cur ? (sub - cur + 0xFFFFFFFFu) >> 32 : 0);
         }
+        uint64_t cur = u[j+nv];
+        u[j+nv] = (uint32_t)(cur - k);
+        
+        /* Estimate was one too large, add back */
+        if(k > cur){
+            qhat--;
+            uint64_t c = 0;
+            for(int i = 0; i < nv; i++){
+                c += (uint64_t)u[i+j] + v[i];
+                u[i+j] = (uint32_t)c;
+                c >>= 32;
+            }
+            u[j+nv] += (uint32_t)c;
+        }
+        q[j] = (uint32_t)qhat;
     }
-    
-    putchar(close);
 }
 
-void lval_print(lval* v){
-    long temp;
-    switch(v->type){
-            /* if lval type is a number use regular printf */
-        case LVAL_NUM:
-            temp = (long)(v->num);
-            printf("%1ld", temp);
-            break;
-        case LVAL_DBL:
-            printf("%f", v->num);
-            break;
-            /* if lval is an error print the appropriate error message*/
-        case LVAL_ERR:
-            printf("ERROR: %s", v->err);
-            break;
-        case LVAL_SYM:
-            printf("%s", v->sym);
-            break;
-        case LVAL_SEXPR:
-            lval_expr_print(v, '(', ')');
-            break;
-        case LVAL_QEXPR:
-            lval_expr_print(v, '{', '}');
-            break;
-        case LVAL_FUN:
-            if(v->builtin){
-                printf("<builtin>");
-            } else {
-                printf("\\ ");
-                lval_print(v->formals);
-                putchar(' ');
-                lval_print(v->body);
-                putchar(')');
-            }
-            break;
-        case LVAL_STR:
-            lval_print_str(v);
+/* Reciprocal floor(B^2n / d) of a normalized d of n limbs into x, which
+ ** has room for n + 2 limbs. Returns the limbs of x */
+static int lmag_recip(uint32_t* x, const uint32_t* d, int n){
+    if(n < LBIG_NEWTON){
+        uint32_t* u = calloc(2*n + 1, sizeof(uint32_t));
+        u[2*n] = 1;
+        lmag_knuth(x, u, 2*n, d, n);
+        free(u);
+        return lmag_trim(x, n + 1);
+    }
+    
+    /* The reciprocal y of the top h limbs of d gives x = y B^(n-h) good
+     ** to about h limbs, a Newton step x + x (B^2n - d x) / B^2n doubles
+     ** that. With e = B^(n+h) - d y the step is y B^(n-h) + e y / B^2h */
+    int h = n / 2 + 1;
+    uint32_t* y = malloc(sizeof(uint32_t) * (h + 2));
+    int ny = lmag_recip(y, d + n - h, h);
+    
+    uint32_t* p = malloc(sizeof(uint32_t) * (n + ny + n + h + 2));
+    uint32_t* e = p + n + ny;
+    lmag_mul(p, d, n, y, ny);
+    int np = lmag_trim(p, n + ny);
+    
+    memset(e, 0, sizeof(uint32_t) * (n + h + 1));
+    e[n + h] = 1;
+    int neg = lmag_cmp(p, np, e, n + h + 1) > 0;
+    int ne = neg ? lmag_sub(e, p, np, e, n + h + 1) : lmag_sub(e, e, n + h + 1, p, np);
+    
+    uint32_t* m = malloc(sizeof(uint32_t) * (ne + ny));
+    lmag_mul(m, e, ne, y, ny);
+    int nm = lmag_trim(m, ne + ny);
+    
+    memset(x, 0, sizeof(uint32_t) * (n + 2));
+    memcpy(x + n - h, y, sizeof(uint32_t) * ny);
+    int nx = lmag_trim(x, n + 2);
+    if(nm > 2*h && neg){
+        nx = lmag_sub(x, x, nx, m + 2*h, nm - 2*h);
+    } else if(nm > 2*h){
+        nx = nx >= nm - 2*h ? lmag_add(x, x, nx, m + 2*h, nm - 2*h) : lmag_add(x, m + 2*h, nm - 2*h, x, nx);
+    }
+    free(m);
+    free(p);
+    free(y);
+    
+    /* Off by a few, step x until d x <= B^2n < d (x + 1) */
+    uint32_t* t = malloc(sizeof(uint32_t) * (2*n + 3 + 2*n + 1));
+    uint32_t* b2n = t + 2*n + 3;
+    memset(b2n, 0, sizeof(uint32_t) * (2*n + 1));
+    b2n[2*n] = 1;
+    lmag_mul(t, d, n, x, nx);
+    int nt = lmag_trim(t, n + nx);
+    uint32_t one = 1;
+    while(lmag_cmp(t, nt, b2n, 2*n + 1) > 0){
+        nx = lmag_sub(x, x, nx, &one, 1);
+        nt = lmag_sub(t, t, nt, d, n);
+    }
+    while(1){
+        nt = lmag_add(t, t, nt, d, n);
+        if(lmag_cmp(t, nt, b2n, 2*n + 1) > 0){
             break;
+        }
+        nx = lmag_add(x, x, nx, &one, 1);
     }
+    free(t);
+    return nx;
 }
 
-void lval_print_str(lval* v){
-    
-    char* escaped = malloc(strlen(v->str)+1);
-    strcpy(escaped, v->str);
+/* Long division of the nun limbs of un by a normalized vn in base B^nv,
+ ** each step a product with the reciprocal of vn and one with vn. q has
+ ** room for nun limbs, un is left with the remainder */
+static void lmag_newton(uint32_t* q, uint32_t* un, int nun, const uint32_t* vn, int nv){
+    uint32_t* x = malloc(sizeof(uint32_t) * (nv + 2));
+    int nx = lmag_recip(x, vn, nv);
+    
+    uint32_t* num = malloc(sizeof(uint32_t) * (2*nv + 1 + 3*nv + 3 + 2*nv + 2));
+    uint32_t* prod = num + 2*nv + 1;
+    uint32_t* back = prod + 3*nv + 3;
+    uint32_t one = 1;
+    
+    memset(q, 0, sizeof(uint32_t) * nun);
+    int k = nun % nv ? nun % nv : nv;
+    int nn = 0;
+    for(int lo = nun - k; lo >= 0; lo -= nv){
+        /* num = remainder B^k + the k limbs at lo, below vn B^k */
+        memmove(num + k, num, sizeof(uint32_t) * nn);
+        memcpy(num, un + lo, sizeof(uint32_t) * k);
+        nn = lmag_trim(num, k + nn);
+        
+        /* num x / B^2nv is at most two short of the quotient */
+        lmag_mul(prod, num, nn, x, nx);
+        int np = lmag_trim(prod, nn + nx);
+        uint32_t* qb = prod + 2*nv;
+        int nq = np > 2*nv ? np - 2*nv : 0;
+        
+        lmag_mul(back, qb, nq, vn, nv);
+        nn = lmag_sub(num, num, nn, back, lmag_trim(back, nq + nv));
+        while(lmag_cmp(num, nn, vn, nv) >= 0){
+            nn = lmag_sub(num, num, nn, vn, nv);
+            nq = lmag_add(qb, qb, nq, &one, 1);
+        }
+        memcpy(q + lo, qb, sizeof(uint32_t) * nq);
+        k = nv;
+    }
     
-    escaped = mpcf_escape(escaped);
+    memset(un, 0, sizeof(uint32_t) * (nv + 1));
+    memcpy(un, num, sizeof(uint32_t) * nn);
+    free(num);
+    free(x);
+}
+
+/* q = u / v and r = u % v for u >= v of nu and nv limbs. q has room for
+ ** nu - nv + 1 limbs and r for nv. Returns the limbs of r */
+static int lmag_divmod(uint32_t* q, uint32_t* r, const uint32_t* u, int nu, const uint32_t* v, int nv){
+    if(nv == 1){
+        memcpy(q, u, sizeof(uint32_t) * nu);
+        r[0] = lmag_divsmall(q, nu, v[0]);
+        return lmag_trim(r, 1);
+    }
     
-    printf("\"%s\"", escaped);
+    /* Normalize so the top bit of v is set */
+    int s = lmag_clz(v[nv-1]);
+    uint32_t* vn = malloc(sizeof(uint32_t) * (nv + 1 + nu + 1 + nu + 1));
+    uint32_t* un = vn + nv + 1;
+    uint32_t* qn = un + nu + 1;
+    lmag_shl(vn, v, nv, s);
+    lmag_shl(un, u, nu, s);
+    
+    int nun = lmag_trim(un, nu + 1);
+    if(nv < LBIG_NEWTON || nun - nv < LBIG_NEWTON){
+        lmag_knuth(qn, un, nu, vn, nv);
+    } else {
+        lmag_newton(qn, un, nun, vn, nv);
+    }
+    memcpy(q, qn, sizeof(uint32_t) * (nu - nv + 1));
     
-    free(escaped);
+    /* Remainder back from the normalized one */
+    for(int i = 0; i < nv; i++){
+        r[i] = (un[i] >> s) | (s ? un[i+1] << (32 - s) : 0);
+    }
+    free(vn);
+    return lmag_trim(r, nv);
 }
 
-void lval_println(lval* v){
-    lval_print(v);
-    putchar('\n');
+/* New copy of b with its sign times sign */
+static lbig* lbig_dup(lbig* b, int sign){
+    lbig* r = lbig_new(b->count);
+    memcpy(r->limbs, b->limbs, sizeof(uint32_t) * b->count);
+    r->count = b->count;
+    r->sign = b->sign * sign;
+    return r;
 }
 
-lval* lval_pop(lval* v, int i){
-    
-    lval* x = v->cell[i];
-    
-    // Shift memory
-    memmove(&v->cell[i], &v->cell[i+1], sizeof(lval*) * (v->count-i-1));
-    
-    // Decrease count
-    v->count--;
-    
-    // Reallocate memory
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-    
-    return x;
+lbig* lbig_from_int(int64_t x){
+    uint64_t m = x < 0 ? 0 - (uint64_t)x : (uint64_t)x;
+    lbig* b = lbig_new(2);
+    b->limbs[0] = (uint32_t)m;
+    b->limbs[1] = (uint32_t)(m >> 32);
+    b->count = lmag_trim(b->limbs, 2);
+    b->sign = x < 0 ? -1 : 1;
+    return b;
 }
 
-lval* lval_take(lval* v, int i){
-    lval* x = lval_pop(v,i);
-    lval_del(v);
-    return x;
+/* Whether b is an int64, its value into *x if so */
+int lbig_int(lbig* b, int64_t* x){
+    if(b->count > 2){
+        return 0;
+    }
+    uint64_t m = b->count == 0 ? 0 : b->limbs[0];
+    if(b->count == 2){
+        m |= (uint64_t)b->limbs[1] << 32;
+    }
+    if(m > (uint64_t)INT64_MAX + (b->sign < 0)){
+        return 0;
+    }
+    *x = b->sign < 0 ? (int64_t)(0 - m) : (int64_t)m;
+    return 1;
 }
 
+/* Leading limbs of b as a double, times 2^*exp */
+static double lbig_frexp(lbig* b, int* exp){
+    double x = 0;
+    int lo = b->count > 3 ? b->count - 3 : 0;
+    for(int i = b->count - 1; i >= lo; i--){
+        x = x * 4294967296.0 + b->limbs[i];
+    }
+    *exp = 32 * lo;
+    return b->sign * x;
+}
 
-lval* builtin_add(lenv* e, lval* a){
-    return builtin_op(e, a, "+");
+double lbig_dbl(lbig* b){
+    int exp;
+    double x = lbig_frexp(b, &exp);
+    return ldexp(x, exp);
 }
 
-lval* builtin_sub(lenv* e, lval* a){
-    return builtin_op(e, a, "-");
+/* a / b as a double from the leading limbs, also when a and b are out of
+ ** the range of doubles */
+double lbig_ratio(lbig* a, lbig* b){
+    int ea, eb;
+    double x = lbig_frexp(a, &ea);
+    double y = lbig_frexp(b, &eb);
+    return ldexp(x / y, ea - eb);
 }
 
-lval* builtin_mul(lenv* e, lval* a){
-    return builtin_op(e, a, "*");
+int lbig_cmp(lbig* a, lbig* b){
+    if(a->sign != b->sign){
+        return a->sign;
+    }
+    return a->sign * lmag_cmp(a->limbs, a->count, b->limbs, b->count);
+}
+/* Sign of zero is always positive */
+static lbig* lbig_norm(lbig* r){
+    r->count = lmag_trim(r->limbs, r->count);
+    if(r->count == 0){
+        r->sign = 1;
+    }
+    return r;
 }
 
-lval* builtin_div(lenv* e, lval* a){
-    return builtin_op(e, a, "/");
+/* a + b, or a - b when sub is set */
+lbig* lbig_add(lbig* a, lbig* b, int sub){
+    int sb = sub ? -b->sign : b->sign;
+    lbig* r = NULL;
+    if(a->sign == sb){
+        int big = a->count > b->count;
+        lbig* x = big ? a : b;
+        lbig* y = big ? b : a;
+        r = lbig_new(x->count + 1);
+        r->count = lmag_add(r->limbs, x->limbs, x->count, y->limbs, y->count);
+        r->sign = a->sign;
+    } else if(lmag_cmp(a->limbs, a->count, b->limbs, b->count) >= 0){
+        r = lbig_new(a->count);
+        r->count = lmag_sub(r->limbs, a->limbs, a->count, b->limbs, b->count);
+        r->sign = a->sign;
+    } else {
+        r = lbig_new(b->count);
+        r->count = lmag_sub(r->limbs, b->limbs, b->count, a->limbs, a->count);
+        r->sign = sb;
+    }
+    return lbig_norm(r);
 }
 
-lval* builtin_op(lenv* e, lval* a, char* op){
-    
-    /* Ensure all arguments are numbers */
-    for(int i = 0; i < a->count; i++ ){
-        LASSERT(a, (a->cell[i]->type == LVAL_NUM || a->cell[i]->type == LVAL_DBL),
-                "Function '%s' passed incorrect types for argument %i. Got %s, Expected %s or %s",
-                op,
-                i,
-                ltype_name(a->cell[0]->cell[i]->type),
-                ltype_name(LVAL_NUM),ltype_name(LVAL_DBL));
+lbig* lbig_mul(lbig* a, lbig* b){
+    lbig* r = lbig_new(a->count + b->count);
+    if(a->count && b->count){
+        lmag_mul(r->limbs, a->limbs, a->count, b->limbs, b->count);
+        r->count = a->count + b->count;
+        r->sign = a->sign * b->sign;
+    }
+    return lbig_norm(r);
+}
+
+/* Truncating quotient and remainder of a nonzero b, *r may be NULL */
+lbig* lbig_div(lbig* a, lbig* b, lbig** r){
+    if(lmag_cmp(a->limbs, a->count, b->limbs, b->count) < 0){
+        if(r){
+            *r = lbig_dup(a, 1);
+        }
+        return lbig_new(0);
     }
     
-    // Pop first element
-    lval* x = lval_pop(a, 0);
-    
-    // if no arguments perform unary op
-    if((strcmp(op, "-") == 0) && a->count == 0){
-        x->num = -x->num;
+    lbig* q = lbig_new(a->count - b->count + 1);
+    lbig* m = lbig_new(b->count);
+    q->count = a->count - b->count + 1;
+    m->count = lmag_divmod(q->limbs, m->limbs, a->limbs, a->count, b->limbs, b->count);
+    q->sign = a->sign * b->sign;
+    m->sign = a->sign;
+    lbig_norm(q);
+    lbig_norm(m);
+    if(r){
+        *r = m;
+    } else {
+        lbig_del(m);
     }
+    return q;
+}
 
+/* Powers 10^(9 2^k) by repeated squaring, kept for the process */
+static struct {
+    uint32_t* limbs;
+    int count;
+} lbig_pow10[32];
 
-    // While there are element remaning
-    while( a->count > 0){
-        
-        lval* y = lval_pop(a,0);
+static void lbig_pow10_fill(int k){
+    if(lbig_pow10[k].limbs){
+        return;
+    }
+    if(k == 0){
+        lbig_pow10[0].limbs = malloc(sizeof(uint32_t));
+        lbig_pow10[0].limbs[0] = 1000000000u;
+        lbig_pow10[0].count = 1;
+        return;
+    }
+    lbig_pow10_fill(k - 1);
+    uint32_t* p = lbig_pow10[k-1].limbs;
+    int n = lbig_pow10[k-1].count;
+    lbig_pow10[k].limbs = malloc(sizeof(uint32_t) * 2 * n);
+    lmag_mul(lbig_pow10[k].limbs, p, n, p, n);
+    lbig_pow10[k].count = lmag_trim(lbig_pow10[k].limbs, 2 * n);
+}
+
+/* Decimal digits of the na limbs at a into s, exactly width of them with
+ ** leading zeros, or as many as needed when width is negative. Returns
+ ** the digits written */
+static int lmag_str(char* s, const uint32_t* a, int na, int width){
+    na = lmag_trim(a, na);
+    if(na <= LBIG_DECIMAL){
+        /* Nine digits per short division, least significant first */
+        uint32_t t[LBIG_DECIMAL];
+        char d[LBIG_DECIMAL * 10 + 1];
+        memcpy(t, a, sizeof(uint32_t) * na);
+        int n = 0;
+        while(na > 0){
+            uint32_t k = lmag_divsmall(t, na, 1000000000u);
+            na = lmag_trim(t, na);
+            for(int i = 0; i < 9; i++, k /= 10){
+                d[n++] = (char)('0' + k % 10);
+            }
+        }
+        while(n > 0 && d[n-1] == '0'){
+            n--;
+        }
+        if(width < 0 && n == 0){
+            d[n++] = '0';
+        }
         
-        if(strcmp(op, "/") == 0 && y->num == 0) {
-            lval_del(x);
-            lval_del(y);
-            x = lval_err("Division By Zero!");
+        /* Leading zeros go straight to s, a low half can be much wider than d */
+        int pad = width > n ? width - n : 0;
+        memset(s, '0', pad);
+        for(int i = 0; i < n; i++){
+            s[pad + i] = d[n-1-i];
+        }
+        return pad + n;
+    }
+    
+    /* Split at the largest cached power about half as long as a */
+    int k = 0;
+    while(1){
+        lbig_pow10_fill(k + 1);
+        if(2 * lbig_pow10[k+1].count - 1 > na){
             break;
         }
+        k++;
+    }
+    uint32_t* p = lbig_pow10[k].limbs;
+    int np = lbig_pow10[k].count;
+    int digits = 9 << k;
+    
+    uint32_t* q = malloc(sizeof(uint32_t) * (na - np + 1 + np));
+    uint32_t* r = q + na - np + 1;
+    int nr = lmag_divmod(q, r, a, na, p, np);
+    int hi = lmag_str(s, q, na - np + 1, width < 0 ? -1 : width - digits);
+    int lo = lmag_str(s + hi, r, nr, digits);
+    free(q);
+    return hi + lo;
+}
 
-        // Perform operation
+/* Printed length bound of b, including sign and terminator */
+int lbig_strlen(lbig* b){
+    return b->count * 10 + 3;
+}
 
-        x->num = builtin_op_helper(op, x->num,y->num);
-        
-        lval_del(y);
+/* b in decimal into s, which holds lbig_strlen(b) bytes */
+void lbig_str(lbig* b, char* s){
+    if(b->sign < 0){
+        *s++ = '-';
     }
-    
-    if(fmod(x->num , 1) != 0){
-        x->type = LVAL_DBL;
+    s[lmag_str(s, b->limbs, b->count, -1)] = '\0';
+}
+
+/* Value of the n decimal digits at s */
+static lbig* lbig_digits(const char* s, int n){
+    if(n <= 9 * LBIG_DECIMAL){
+        /* Multiply and add nine digits at a time */
+        lbig* r = lbig_new(n / 9 + 2);
+        int nr = 0;
+        for(int i = 0; i < n; ){
+            int len = n - i < 9 ? n - i : 9;
+            uint32_t g = 0, m = 1;
+            for(int j = 0; j < len; j++, i++){
+                g = g * 10 + (uint32_t)(s[i] - '0');
+                m *= 10;
+            }
+            uint64_t c = g;
+            for(int j = 0; j < nr; j++){
+                c += (uint64_t)r->limbs[j] * m;
+                r->limbs[j] = (uint32_t)c;
+                c >>= 32;
+            }
+            if(c){
+                r->limbs[nr++] = (uint32_t)c;
+            }
+        }
+        r->count = nr;
+        return lbig_norm(r);
     }
-    lval_del(a);
     
-    return x;
+    /* Digits below the largest power at most half of them, then the
+     ** value is hi 10^(9 2^k) + lo */
+    int k = 0;
+    while(2 * (9 << (k + 1)) <= n){
+        k++;
+    }
+    lbig_pow10_fill(k);
+    int digits = 9 << k;
+    lbig* hi = lbig_digits(s, n - digits);
+    lbig* lo = lbig_digits(s + n - digits, digits);
+    
+    int np = lbig_pow10[k].count;
+    lbig* r = lbig_new(hi->count + np + 1);
+    r->count = hi->count + np + 1;
+    memset(r->limbs, 0, sizeof(uint32_t) * r->count);
+    if(hi->count){
+        lmag_mul(r->limbs, hi->limbs, hi->count, lbig_pow10[k].limbs, np);
+    }
+    lmag_addto(r->limbs, r->count, lo->limbs, lo->count);
+    lbig_del(hi);
+    lbig_del(lo);
+    return lbig_norm(r);
 }
 
-double builtin_op_helper(char* op, double x, double y){
-    
-    if(strcmp(op, "+") == 0){
-        x += y;
+/* Value of a decimal integer with an optional sign */
+lbig* lbig_read(const char* s){
+    int sign = 1;
+    if(*s == '-' || *s == '+'){
+        sign = *s++ == '-' ? -1 : 1;
     }
+    lbig* r = lbig_digits(s, (int)strlen(s));
+    if(r->count){
+        r->sign = sign;
+    }
+    return r;
+}
+
+/*
+ ** Vector Kernels
+ **
+ ** Loops over unboxed doubles, four lanes at a time through the GCC
+ ** vector extensions. Each kernel is written once and inlined into a
+ ** baseline build and an AVX2 build, lvec_init picks one at startup.
+ ** Reductions keep eight partial results combined in a fixed order, as
+ ** does the scalar fallback, so sums come out the same on every build.
+ */
+typedef struct lvec_kernels {
+    /* r = x op y elementwise, op an arithmetic or ordering LPRIM. A
+     ** stride of 0 repeats the first number, r may be x or y */
+    void (*map)(int op, double* r, const double* x, long xs, const double* y, long ys, long n);
     
-    if(strcmp(op, "-") == 0) {  x -= y;}
+    /* Sum of x, or of x times y unless y is NULL */
+    double (*sum)(const double* x, const double* y, long n);
     
-    if(strcmp(op, "*") == 0) {  x *= y;}
+    /* Smallest or largest of n > 0 numbers */
+    double (*extreme)(const double* x, long n, int max);
     
-    if(strcmp(op, "/") == 0) {
-        // if value is equal to zero, return error
-        
-        x /= y;
-    }  
+    /* c += a b for row-major a of m by k and b of k by n */
+    void (*gemm)(double* c, const double* a, const double* b, long m, long k, long n);
+} lvec_kernels;
 
-    return x;
+#ifdef __GNUC__
+
+typedef double lv4 __attribute__((vector_size(32)));
+typedef long long lv4i __attribute__((vector_size(32)));
+
+#define LV4_LOAD(v, p) memcpy(&(v), (p), sizeof(lv4))
+#define LV4_STORE(p, v) memcpy((p), &(v), sizeof(lv4))
+
+/* Four numbers at p, or the first repeated for a stride of 0 */
+#define LV4_GET(v, p, s) do { \
+    if(s){ LV4_LOAD(v, p); } else { (v) = (lv4){ 0, 0, 0, 0 } + *(p); } \
+} while(0)
+
+#define LVEC_MAP_LOOP(EXPR, TAIL) \
+    for(; i + 4 <= n; i += 4){ \
+        lv4 a, b; \
+        LV4_GET(a, x + i * xs, xs); \
+        LV4_GET(b, y + i * ys, ys); \
+        a = EXPR; \
+        LV4_STORE(r + i, a); \
+    } \
+    for(; i < n; i++){ r[i] = TAIL; }
+
+/* Comparisons give all ones lanes, masked down to 1.0 */
+#define LVEC_MAP_ARITH(OP) LVEC_MAP_LOOP(a OP b, x[i * xs] OP y[i * ys])
+#define LVEC_MAP_CMP(OP) \
+    LVEC_MAP_LOOP((lv4)((lv4i)(a OP b) & (lv4i)one), x[i * xs] OP y[i * ys])
+
+static inline __attribute__((always_inline))
+void lvec_map_lanes(int op, double* r, const double* x, long xs, const double* y, long ys, long n){
+    const lv4 one = { 1, 1, 1, 1 };
+    long i = 0;
+    switch(op){
+        case LPRIM_ADD: LVEC_MAP_ARITH(+); break;
+        case LPRIM_SUB: LVEC_MAP_ARITH(-); break;
+        case LPRIM_MUL: LVEC_MAP_ARITH(*); break;
+        case LPRIM_DIV: LVEC_MAP_ARITH(/); break;
+        case LPRIM_LT:  LVEC_MAP_CMP(<); break;
+        case LPRIM_GT:  LVEC_MAP_CMP(>); break;
+        case LPRIM_LTE: LVEC_MAP_CMP(<=); break;
+        case LPRIM_GTE: LVEC_MAP_CMP(>=); break;
+    }
 }
 
-lval* builtin_ord(lenv* e, lval* a,char* op){
-    
-    LASSERT_ARGS(op, a, 2);
-    LASSERT_TYPE(op, a, 0, LVAL_NUM);
-    LASSERT_TYPE(op, a, 1, LVAL_NUM);
-    
-    int r;
-    if(strcmp(op, "<") == 0) {
-        r = (a->cell[0]->num < a->cell[1]->num);
+/* Strides as constants, so the loops carry no checks */
+static inline __attribute__((always_inline))
+void lvec_map_strided(int op, double* r, const double* x, long xs, const double* y, long ys, long n){
+    if(xs && ys){
+        lvec_map_lanes(op, r, x, 1, y, 1, n);
+    } else if(xs){
+        lvec_map_lanes(op, r, x, 1, y, 0, n);
+    } else {
+        lvec_map_lanes(op, r, x, 0, y, 1, n);
     }
-    if(strcmp(op, ">") == 0) {
-        r = (a->cell[0]->num > a->cell[1]->num);
+}
+
+static inline __attribute__((always_inline))
+double lvec_sum_lanes(const double* x, const double* y, long n, int dot){
+    lv4 s0 = { 0, 0, 0, 0 };
+    lv4 s1 = s0;
+    long i = 0;
+    for(; i + 8 <= n; i += 8){
+        lv4 a0, a1;
+        LV4_LOAD(a0, x + i);
+        LV4_LOAD(a1, x + i + 4);
+        if(dot){
+            lv4 b0, b1;
+            LV4_LOAD(b0, y + i);
+            LV4_LOAD(b1, y + i + 4);
+            a0 *= b0;
+            a1 *= b1;
+        }
+        s0 += a0;
+        s1 += a1;
     }
-    if(strcmp(op, ">=") == 0) {
-        r = (a->cell[0]->num >= a->cell[1]->num);
+    s0 += s1;
+    double s = (s0[0] + s0[1]) + (s0[2] + s0[3]);
+    for(; i < n; i++){
+        s += dot ? x[i] * y[i] : x[i];
     }
-    if(strcmp(op, "<=") == 0) {
-        r = (a->cell[0]->num <= a->cell[1]->num);
+    return s;
+}
+
+/* Blocking of the matrix product: b is packed KC by NC at a time and a
+ ** MC by KC, so both stay in cache while tiles of c MR by NR stay in
+ ** registers. Each number of c still sums its products in order */
+#define LGEMM_MR 4
+#define LGEMM_NR 8
+#define LGEMM_KC 256
+#define LGEMM_NC 256
+#define LGEMM_MC 64
+
+/* Rows p0 to p0 + kc and columns j0 to j0 + nc of b as panels NR wide,
+ ** zero padded */
+static void lgemm_pack_b(double* bp, const double* b, long n, long p0, long kc, long j0, long nc){
+    for(long j = 0; j < nc; j += LGEMM_NR){
+        long w = nc - j < LGEMM_NR ? nc - j : LGEMM_NR;
+        for(long p = 0; p < kc; p++){
+            const double* row = b + (p0 + p) * n + j0 + j;
+            for(long jj = 0; jj < LGEMM_NR; jj++){
+                *bp++ = jj < w ? row[jj] : 0;
+            }
+        }
     }
-    
-    return lval_num(r,LVAL_NUM);
 }
 
-lval* builtin_gt(lenv* e, lval* a){
-    return builtin_ord(e, a, ">");
+/* Rows i0 to i0 + mc and columns p0 to p0 + kc of a as panels MR high,
+ ** zero padded */
+static void lgemm_pack_a(double* ap, const double* a, long k, long i0, long mc, long p0, long kc){
+    for(long i = 0; i < mc; i += LGEMM_MR){
+        long h = mc - i < LGEMM_MR ? mc - i : LGEMM_MR;
+        for(long p = 0; p < kc; p++){
+            for(long ii = 0; ii < LGEMM_MR; ii++){
+                *ap++ = ii < h ? a[(i0 + i + ii) * k + p0 + p] : 0;
+            }
+        }
+    }
 }
 
-lval* builtin_lt(lenv* e, lval* a){
-    return builtin_ord(e, a, "<");
+/* Row r of a tile, two vectors of accumulators */
+#define LGEMM_ROW(r) \
+    a = (lv4){ 0, 0, 0, 0 } + ap[r]; \
+    c##r##0 += a * b0; \
+    c##r##1 += a * b1;
+
+#define LGEMM_LOAD(r) LV4_LOAD(c##r##0, c + r * ldc); LV4_LOAD(c##r##1, c + r * ldc + 4);
+#define LGEMM_STORE(r) LV4_STORE(c + r * ldc, c##r##0); LV4_STORE(c + r * ldc + 4, c##r##1);
+
+/* MR by NR tile of c += the packed panels of a and b */
+static inline __attribute__((always_inline))
+void lgemm_tile_lanes(long kc, const double* ap, const double* bp, double* c, long ldc){
+    lv4 c00, c01, c10, c11, c20, c21, c30, c31;
+    LGEMM_LOAD(0) LGEMM_LOAD(1) LGEMM_LOAD(2) LGEMM_LOAD(3)
+    for(long p = 0; p < kc; p++){
+        lv4 a, b0, b1;
+        LV4_LOAD(b0, bp);
+        LV4_LOAD(b1, bp + 4);
+        LGEMM_ROW(0) LGEMM_ROW(1) LGEMM_ROW(2) LGEMM_ROW(3)
+        ap += LGEMM_MR;
+        bp += LGEMM_NR;
+    }
+    LGEMM_STORE(0) LGEMM_STORE(1) LGEMM_STORE(2) LGEMM_STORE(3)
 }
 
-lval* builtin_gte(lenv* e, lval* a){
-    return builtin_ord(e, a, ">=");
+static inline __attribute__((always_inline))
+void lgemm_lanes(double* c, const double* a, const double* b, long m, long k, long n){
+    double* ap = malloc(sizeof(double) * LGEMM_MC * LGEMM_KC);
+    double* bp = malloc(sizeof(double) * LGEMM_KC * LGEMM_NC);
+    for(long jc = 0; jc < n; jc += LGEMM_NC){
+        long nc = n - jc < LGEMM_NC ? n - jc : LGEMM_NC;
+        for(long pc = 0; pc < k; pc += LGEMM_KC){
+            long kc = k - pc < LGEMM_KC ? k - pc : LGEMM_KC;
+            lgemm_pack_b(bp, b, n, pc, kc, jc, nc);
+            for(long ic = 0; ic < m; ic += LGEMM_MC){
+                long mc = m - ic < LGEMM_MC ? m - ic : LGEMM_MC;
+                lgemm_pack_a(ap, a, k, ic, mc, pc, kc);
+                for(long jr = 0; jr < nc; jr += LGEMM_NR){
+                    long w = nc - jr < LGEMM_NR ? nc - jr : LGEMM_NR;
+                    for(long ir = 0; ir < mc; ir += LGEMM_MR){
+                        long h = mc - ir < LGEMM_MR ? mc - ir : LGEMM_MR;
+                        double* ct = c + (ic + ir) * n + jc + jr;
+                        if(h == LGEMM_MR && w == LGEMM_NR){
+                            lgemm_tile_lanes(kc, ap + ir * kc, bp + jr * kc, ct, n);
+                            continue;
+                        }
+                        
+                        // Edge tile, through a full one
+                        double t[LGEMM_MR * LGEMM_NR] = { 0 };
+                        for(long i = 0; i < h; i++){
+                            memcpy(t + i * LGEMM_NR, ct + i * n, sizeof(double) * w);
+                        }
+                        lgemm_tile_lanes(kc, ap + ir * kc, bp + jr * kc, t, LGEMM_NR);
+                        for(long i = 0; i < h; i++){
+                            memcpy(ct + i * n, t + i * LGEMM_NR, sizeof(double) * w);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    free(bp);
+    free(ap);
 }
 
-lval* builtin_lte(lenv* e, lval* a){
-    return builtin_ord(e, a, "<=");
+static inline __attribute__((always_inline))
+double lvec_extreme_lanes(const double* x, long n, int max){
+    double m = x[0];
+    long i = 1;
+    if(n >= 8){
+        lv4 k;
+        LV4_LOAD(k, x);
+        for(i = 4; i + 4 <= n; i += 4){
+            lv4 a;
+            LV4_LOAD(a, x + i);
+            lv4i take = max ? (lv4i)(a > k) : (lv4i)(a < k);
+            k = (lv4)(((lv4i)a & take) | ((lv4i)k & ~take));
+        }
+        m = k[0];
+        for(int j = 1; j < 4; j++){
+            m = (max ? k[j] > m : k[j] < m) ? k[j] : m;
+        }
+    }
+    for(; i < n; i++){
+        m = (max ? x[i] > m : x[i] < m) ? x[i] : m;
+    }
+    return m;
 }
 
-lval* builtin_cmp(lenv* e, lval* a, char* op){
-    LASSERT_ARGS(op, a, 2);
-    
-    int r;
-    
-    if(strcmp(op, "==") == 0){
-        r = lval_eq(a->cell[0], a->cell[1]);
+/* Instances of the kernels for a target, the generic ones get inlined
+ ** and built for it */
+#define LVEC_KERNELS(NAME, TARGET) \
+    TARGET static void lvec_map_##NAME(int op, double* r, const double* x, long xs, const double* y, long ys, long n){ \
+        lvec_map_strided(op, r, x, xs, y, ys, n); \
+    } \
+    TARGET static double lvec_sum_##NAME(const double* x, const double* y, long n){ \
+        return y ? lvec_sum_lanes(x, y, n, 1) : lvec_sum_lanes(x, NULL, n, 0); \
+    } \
+    TARGET static double lvec_extreme_##NAME(const double* x, long n, int max){ \
+        return max ? lvec_extreme_lanes(x, n, 1) : lvec_extreme_lanes(x, n, 0); \
+    } \
+    TARGET static void lvec_gemm_##NAME(double* c, const double* a, const double* b, long m, long k, long n){ \
+        lgemm_lanes(c, a, b, m, k, n); \
     }
-    
-    if(strcmp(op, "!=") == 0){
-        r = !lval_eq(a->cell[0],a->cell[1]);
+
+LVEC_KERNELS(base, )
+#if defined(__x86_64__) || defined(__i386__)
+#define LVEC_AVX2
+LVEC_KERNELS(avx2, __attribute__((target("avx2"))))
+#endif
+
+#else
+
+/* Plain loops, summing in the order of the lane kernels */
+static void lvec_map_base(int op, double* r, const double* x, long xs, const double* y, long ys, long n){
+    for(long i = 0; i < n; i++){
+        double a = x[i * xs];
+        double b = y[i * ys];
+        switch(op){
+            case LPRIM_ADD: r[i] = a + b; break;
+            case LPRIM_SUB: r[i] = a - b; break;
+            case LPRIM_MUL: r[i] = a * b; break;
+            case LPRIM_DIV: r[i] = a / b; break;
+            case LPRIM_LT:  r[i] = a < b; break;
+            case LPRIM_GT:  r[i] = a > b; break;
+            case LPRIM_LTE: r[i] = a <= b; break;
+            case LPRIM_GTE: r[i] = a >= b; break;
+        }
     }
-    
-    lval_del(a);
-    
-    return lval_num(r, LVAL_NUM);
 }
 
-lval* builtin_eq(lenv* e, lval* a){
-    return builtin_cmp(e, a, "==");
+static double lvec_sum_base(const double* x, const double* y, long n){
+    double p[8] = { 0 };
+    long i = 0;
+    for(; i + 8 <= n; i += 8){
+        for(int j = 0; j < 8; j++){
+            p[j] += y ? x[i+j] * y[i+j] : x[i+j];
+        }
+    }
+    double s = ((p[0] + p[4]) + (p[1] + p[5])) + ((p[2] + p[6]) + (p[3] + p[7]));
+    for(; i < n; i++){
+        s += y ? x[i] * y[i] : x[i];
+    }
+    return s;
 }
 
-lval* builtin_ne(lenv* e, lval* a){
-    return builtin_cmp(e, a, "!=");
+static double lvec_extreme_base(const double* x, long n, int max){
+    double m = x[0];
+    for(long i = 1; i < n; i++){
+        m = (max ? x[i] > m : x[i] < m) ? x[i] : m;
+    }
+    return m;
 }
 
-lval* builtin_if(lenv* e, lval* a){
-    LASSERT_ARGS("if", a, 3);
-    LASSERT_TYPE("if", a, 0, LVAL_NUM);
-    LASSERT_TYPE("if", a, 1, LVAL_QEXPR);
-    LASSERT_TYPE("if", a, 2, LVAL_QEXPR);
-    
-    /* Mark both expressions as evaluable */
-    lval* x;
-    a->cell[1]->type = LVAL_SEXPR;
-    a->cell[2]->type = LVAL_SEXPR;
-    
-    
-    if(a->cell[0]->num){
-        /* If condition is true, evaluate first */
-        x = lval_eval(e, lval_pop(a,1));
-    } else {
-        /* Otherwise evalute second expression */
-        x = lval_eval(e, lval_pop(a,2));
+/* Rows of c in turn, streaming through b */
+static void lvec_gemm_base(double* c, const double* a, const double* b, long m, long k, long n){
+    for(long i = 0; i < m; i++){
+        for(long p = 0; p < k; p++){
+            double x = a[i * k + p];
+            for(long j = 0; j < n; j++){
+                c[i * n + j] += x * b[p * n + j];
+            }
+        }
     }
-    
-    lval_del(a);
-    
-    return x;
 }
 
-lval* builtin_head(lenv* e, lval* a){
-    
-    // Check for errors
-    LASSERT_ARGS("head", a, 1);
-    LASSERT_TYPE("head", a, 0, LVAL_QEXPR);
-    LASSERT(a, (a->cell[0]->count != 0), "Function 'head' passed {}!");
-    
-    
-    lval* v = lval_take(a, 0);
-    
-    while( v->count > 1) {
-        lval_del(lval_pop(v,1));
+#endif
+
+static lvec_kernels lvec_k = { lvec_map_base, lvec_sum_base, lvec_extreme_base, lvec_gemm_base };
+
+/* Pick the widest kernels the processor runs */
+void lvec_init(void){
+#ifdef LVEC_AVX2
+    if(__builtin_cpu_supports("avx2")){
+        lvec_k = (lvec_kernels){ lvec_map_avx2, lvec_sum_avx2, lvec_extreme_avx2, lvec_gemm_avx2 };
     }
-    
-    return v;
+#endif
 }
 
-lval* builtin_tail(lenv* e, lval* a){
-    
-    // Check for errors
-    LASSERT_ARGS("tail", a, 1);
-    LASSERT_TYPE("tail", a, 0, LVAL_QEXPR);
-    LASSERT(a, (a->cell[0]->count != 0), "Function 'tail' passed {}!");
-    
-    
-    // Take first argument
-    lval* v= lval_take(a, 0);
-    
-    // Delete first element and return
-    lval_del(lval_pop(v,0));
-    
-    return v;
+/*
+ ** Symbol Table
+ **
+ ** Symbols are interned, lval_sym and enviorments hold the table's lsym
+ ** so names compare by pointer. Symbols live as long as the table.
+ */
+#define LSYM_MIN 256
+
+static unsigned long lsym_hash(char* s){
+    unsigned long h = 2166136261UL;
+    while(*s){
+        h = (h ^ (unsigned char)*s++) * 16777619UL;
+    }
+    return h;
 }
 
-lval* builtin_list(lenv* e, lval* a){
-    a->type = LVAL_QEXPR;
-    return a;
+lsymtab* lsymtab_new(void){
+    lsymtab* t = calloc(1, sizeof(lsymtab));
+    t->cap = LSYM_MIN;
+    t->syms = calloc(t->cap, sizeof(lsym*));
+    t->version = 1;
+    return t;
 }
 
-lval* builtin_eval(lenv* e, lval* a){
-    LASSERT_ARGS("eval", a, 1);
-    LASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
-    
-    lval* x = lval_take(a, 0);
-    x->type = LVAL_SEXPR;
-    return lval_eval(e, x);
+void lsymtab_del(lsymtab* t){
+    for(int i = 0; i < t->cap; i++){
+        if(t->syms[i]){
+            free(t->syms[i]->name);
+            free(t->syms[i]);
+        }
+    }
+    free(t->syms);
+    free(t);
 }
 
-lval* lval_join_str(lval* a){
-    
-    
-    lval* x = lval_pop(a, 0);
+/* Double the table, rehashing every name */
+static void lsymtab_grow(lsymtab* t){
+    lsym** syms = t->syms;
+    int cap = t->cap;
+    
+    t->cap *= 2;
+    t->syms = calloc(t->cap, sizeof(lsym*));
+    for(int i = 0; i < cap; i++){
+        if(syms[i]){
+            unsigned long j = lsym_hash(syms[i]->name) & (t->cap - 1);
+            while(t->syms[j]){
+                j = (j + 1) & (t->cap - 1);
+            }
+            t->syms[j] = syms[i];
+        }
+    }
+    free(syms);
+}
+
+/* The symbol named s, added on first use */
+lsym* lsym_intern(char* s){
+    lsymtab* t = Syms;
+    unsigned long i = lsym_hash(s) & (t->cap - 1);
+    
+    while(t->syms[i]){
+        if(strcmp(t->syms[i]->name, s) == 0){
+            return t->syms[i];
+        }
+        i = (i + 1) & (t->cap - 1);
+    }
     
-    while(a->count){
-        lval* y = lval_pop(a, 0);
-        char* temp = (char *)malloc(sizeof(strlen(x->str) + strlen(y->str) + 1));
-        strcpy(temp, x->str);
-        strcat(temp,y->str);
-        strcpy(x->str, temp);
-        free(temp);
+    /* Keep the table at most half full */
+    if(2 * (t->count + 1) > t->cap){
+        lsymtab_grow(t);
+        return lsym_intern(s);
     }
     
+    lsym* y = malloc(sizeof(lsym));
+    y->name = malloc(strlen(s) + 1);
+    strcpy(y->name, s);
+    y->frames = 0;
     
-
-    return x;
+    t->syms[i] = y;
+    t->count++;
+    return y;
 }
 
+/*
+ ** Garbage Collector
+ **
+ ** Generational mark and sweep. Values are shared by pointer and never
+ ** mutated once reachable, collection only happens at the safe point in
+ ** lval_eval where all live temporaries are rooted.
+ **
+ ** New values start in the young generation. A minor collection marks
+ ** from the temporaries, the active frames and the remembered set, sweeps
+ ** only the young values and promotes the survivors in place. Storing a
+ ** young value into the global enviorment or an old list records it in
+ ** the remembered set.
+ **
+ ** The old generation is collected incrementally, in slices of at most
+ ** Heap->budget microseconds interleaved with evaluation. Marking works
+ ** on a snapshot taken when the cycle starts: the temporaries and frames
+ ** are shaded right away, top level enviorments are scanned in slices,
+ ** values promoted during the cycle are black, and values removed from
+ ** an enviorment or list are shaded. Build with -DBLISP_NO_GENGC to
+ ** make every collection a full stop the world one.
+ */
+/* Largest and smallest nursery, it adapts to the pause budget */
+#define LGC_NURSERY 32768
+#define LGC_NURSERY_MIN 1024
+#define LGC_MIN 65536
+
+/* Allocations between incremental slices */
+#define LGC_STEP 2048
 
-lval* builtin_join(lenv* e, lval* a){
-    lval* x = NULL;
-    
-    if(a->cell[0]->type == LVAL_QEXPR){
-        ltype_check("join", a, LVAL_QEXPR);
-        x = lval_pop(a, 0);
-        
-        while(a->count){
-            x = lval_join(x, lval_pop(a, 0));
-        }
-    } else if(a->cell[0]->type == LVAL_STR){
-        ltype_check("join", a, LVAL_STR);
-        x = lval_join_str(a);
+/* Units of work between clock checks */
+#define LGC_CHUNK 256
+
+/* Default pause budget in microseconds */
+#define LGC_BUDGET 1000
+
+/* Default limit on nested evaluations */
+#define LEVAL_DEPTH 100000
+
+/* C stack assumed when its size is not known */
+#define LEVAL_STACK (8 << 20)
+
+enum { LGC_IDLE, LGC_MARK, LGC_SWEEP };
+
+#define LVEC_PUSH(arr, n, cap, x) do { \
+if((n) == (cap)) { \
+(cap) = (cap) ? (cap) * 2 : 64; \
+(arr) = realloc((arr), sizeof(*(arr)) * (cap)); \
+} \
+(arr)[(n)++] = (x); \
+} while(0)
+
+static void lval_free(lval* v);
+
+/* Bytes v holds outside the heap, which count toward collections as
+ ** values of that size */
+static long lval_bytes(lval* v){
+    return v->type == LVAL_VEC || v->type == LVAL_MAT ? (long)sizeof(double) * v->count : 0;
+}
 
+lheap* lheap_new(void){
+    lheap* h = calloc(1, sizeof(lheap));
+    h->nursery = LGC_NURSERY;
+    h->next_gc = LGC_NURSERY;
+    h->next_major = LGC_MIN;
+    h->budget = LGC_BUDGET;
+    h->max_depth = LEVAL_DEPTH;
+    
+    /* Stop evaluating with a quarter of the C stack left */
+    char base;
+    long size = LEVAL_STACK;
+#ifdef _WIN32
+    size = 1 << 20;
+#else
+    struct rlimit rl;
+    if(getrlimit(RLIMIT_STACK, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < LONG_MAX){
+        size = (long)rl.rlim_cur;
     }
-    
-    
-    
-    lval_del(a);
-    
-    return x;
+#endif
+    h->stack = (uintptr_t)&base;
+    h->stack_max = size - size / 4;
+    return h;
 }
 
-lval* builtin_var(lenv* e, lval* a, char* func){
-    LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
-    
-    lval* syms = a->cell[0];
-    for(int i = 0; i < syms->count; i++){
-        LASSERT(a, (syms->cell[i]->type == LVAL_SYM),
-                "Function '%s' cannot define non-symbole. Got %s, Expected %s.",
-                func, ltype_name(syms->cell[i]->type), ltype_name(LVAL_SYM));
+void lheap_del(lheap* h){
+    for(int i = 0; i < h->nyoung; i++){
+        lval_free(h->young[i]);
     }
-    
-    LASSERT(a, (syms->count == a->count-1),
-            "Function '%s' passed too many arguments for symbols. Got %i, Expected %i",
-            func, syms->count, a->count-1);
-    
-    for(int i = 0; i < syms->count; i++){
-        if(strcmp(func, "def") == 0){
-            lenv_def(e, syms->cell[i], a->cell[i+1]);
-        }
+    for(int i = 0; i < h->nold; i++){
         
-        if(strcmp(func, "=") == 0){
-            lenv_put(e, syms->cell[i], a->cell[i+1]);
+        /* Skip what an unfinished sweep already freed */
+        if(h->phase == LGC_SWEEP && i == h->swept){
+            i = h->sweep;
+            if(i == h->nold){
+                break;
+            }
         }
+        lval_free(h->old[i]);
     }
     
-    lval_del(a);
-    return lval_sexpr();
+    free(h->young);
+    free(h->old);
+    free(h->remembered);
+    free(h->mgray);
+    free(h->pending);
+    free(h->roots);
+    free(h->envs);
+    free(h->gray);
+    free(h);
 }
 
-lval* builtin_def(lenv* e, lval* a){
-    return builtin_var(e, a, "def");
+/* Keep v alive across evaluation, released with lgc_unroot */
+void lgc_root(lval* v){
+    LVEC_PUSH(Heap->roots, Heap->nroots, Heap->roots_cap, v);
 }
 
-lval* builtin_put(lenv* e, lval* a){
-    return builtin_var(e, a, "=");
+void lgc_unroot(int n){
+    Heap->nroots -= n;
+    if(Heap->nroots < Heap->roots_clean){
+        Heap->roots_clean = Heap->nroots;
+    }
 }
 
-lval* builtin_lambda(lenv* e, lval* a){
-    
-    
-    LASSERT_TYPE("\\", a, 0, LVAL_QEXPR);
-    LASSERT_TYPE("\\", a, 1, LVAL_QEXPR);
-    
-    /* Check Q-Expression contains only symbols */
-    for(int i = 0; i < a->cell[0]->count; i++ ){
-        LASSERT(a, (a->cell[0]->cell[i]->type == LVAL_SYM),
-                "Cannot define non-symbol. Got %s, Expected %s",
-                ltype_name(a->cell[0]->cell[i]->type), ltype_name(LVAL_SYM));
+void lgc_root_env(lenv* e){
+    LVEC_PUSH(Heap->envs, Heap->nenvs, Heap->envs_cap, e);
+}
+
+void lgc_unroot_env(void){
+    Heap->nenvs--;
+    if(Heap->nenvs < Heap->envs_clean){
+        Heap->envs_clean = Heap->nenvs;
+    }
+}
+
+/* Write barrier, v is being stored where minor collections do not look */
+void lgc_remember(lval* v){
+    if(!v->old){
+        LVEC_PUSH(Heap->remembered, Heap->nremembered, Heap->remembered_cap, v);
+    }
+}
+
+/* Deletion barrier, keeps the marking snapshot intact. Young values
+ ** are newer than the snapshot and left to minor collections */
+void lgc_shade(lval* v){
+    if(Heap->phase != LGC_MARK || !v->old || v->mark){
+        return;
     }
     
-    /* Pop first two arguments and pass them to lval_lambda */
-    lval* formals = lval_pop(a, 0);
-    lval* body = lval_pop(a, 0);
-    lval_del(a);
+    v->mark = 1;
+    LVEC_PUSH(Heap->mgray, Heap->nmgray, Heap->mgray_cap, v);
+}
+
+static void lgc_mark(lval* v){
     
-    return lval_lambda(formals, body);
+    /* Old values are assumed live by a minor collection */
+    if(v->mark || v->old){
+        return;
+    }
     
+    v->mark = 1;
+    LVEC_PUSH(Heap->gray, Heap->ngray, Heap->gray_cap, v);
 }
 
-lval* builtin_load(lenv* e, lval* a){
-    LASSERT_ARGS("load", a, 1);
-    LASSERT_TYPE("load", a, 0, LVAL_STR);
-    
-    /* Parse FIle given */
-    mpc_result_t r;
-    if(mpc_parse_contents(a->cell[0]->str, Blisp, &r)) {
-        
-        /* Read Contents*/
+/* Apply mark to everything v points to, returns the number of pointers */
+static int lgc_trace(lval* v, void (*mark)(lval*)){
+    switch(v->type){
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+            for(int i = 0; i < v->count; i++){
+                mark(v->cell[i]);
+            }
+            return v->count;
+        case LVAL_FUN:
+            if(!v->builtin){
+                lenv* e = v->lambda->env;
+                for(int i = 0; i < e->cap; i++){
+                    if(e->syms[i]){
+                        mark(e->vals[i]);
+                    }
+                }
+                mark(v->lambda->formals);
+                mark(v->lambda->body);
+                if(v->lambda->code){
+                    mark(v->lambda->code->pool);
+                    return e->cap + 3;
+                }
+                return e->cap + 2;
+            }
+            break;
+    }
+    
+    return 0;
+}
+
+static void lgc_minor(void){
+    
+    /* Mark from the frames, temporaries and remembered values. Top level
+     ** enviorments are covered by the remembered set, and so are the
+     ** frames and temporaries left untouched since the last minor */
+    for(int i = Heap->envs_clean; i < Heap->nenvs; i++){
+        lenv* e = Heap->envs[i];
+        if(e->par){
+            for(int j = 0; j < e->cap; j++){
+                if(e->syms[j]){
+                    lgc_mark(e->vals[j]);
+                }
+            }
+        }
+    }
+    for(int i = Heap->roots_clean; i < Heap->nroots; i++){
+        lgc_mark(Heap->roots[i]);
+    }
+    for(int i = 0; i < Heap->nremembered; i++){
+        lgc_mark(Heap->remembered[i]);
+    }
+    Heap->nremembered = 0;
+    Heap->roots_clean = Heap->nroots;
+    Heap->envs_clean = Heap->nenvs;
+    
+    while(Heap->ngray){
+        lgc_trace(Heap->gray[--Heap->ngray], lgc_mark);
+    }
+    
+    /* Sweep the young generation, promoting survivors. Values promoted
+     ** during a major cycle are newer than its snapshot and so black */
+    for(int i = 0; i < Heap->nyoung; i++){
+        lval* v = Heap->young[i];
+        if(v->mark){
+            v->mark = Heap->phase != LGC_IDLE;
+            v->old = 1;
+            Heap->old_bytes += lval_bytes(v);
+            LVEC_PUSH(Heap->old, Heap->nold, Heap->old_cap, v);
+        } else {
+            lval_free(v);
+        }
+    }
+    Heap->nyoung = 0;
+    Heap->young_bytes = 0;
+    Heap->minors++;
+}
+
+/* Take the snapshot of a major collection */
+static void lgc_start(void){
+    
+    /* Everything young is promoted first so the snapshot is all old */
+    if(Heap->nyoung){
+        lgc_minor();
+    }
+    
+    Heap->phase = LGC_MARK;
+    
+    for(int i = 0; i < Heap->nroots; i++){
+        lgc_shade(Heap->roots[i]);
+    }
+    for(int i = 0; i < Heap->nenvs; i++){
+        lenv* e = Heap->envs[i];
+        if(e->par){
+            for(int j = 0; j < e->cap; j++){
+                if(e->syms[j]){
+                    lgc_shade(e->vals[j]);
+                }
+            }
+        } else {
+            LVEC_PUSH(Heap->pending, Heap->npending, Heap->pending_cap, e);
+        }
+    }
+    Heap->scan = 0;
+}
+
+/* Advance a major collection for up to budget microseconds, a negative
+ ** budget runs it to completion */
+static void lgc_step(long budget){
+    clock_t limit = clock() + (clock_t)((double)budget * CLOCKS_PER_SEC / 1000000);
+    
+    long work = 0;
+    long check = LGC_CHUNK;
+    while(Heap->phase != LGC_IDLE){
+        
+        if(budget >= 0 && work >= check){
+            if(clock() >= limit){
+                return;
+            }
+            check = work + LGC_CHUNK;
+        }
+        work++;
+        
+        if(Heap->phase == LGC_MARK){
+            if(Heap->nmgray){
+                work += lgc_trace(Heap->mgray[--Heap->nmgray], lgc_shade);
+            } else if(Heap->npending){
+                /* Scan top level enviorments one binding at a time */
+                lenv* e = Heap->pending[Heap->npending-1];
+                if(Heap->scan < e->cap){
+                    if(e->syms[Heap->scan]){
+                        lgc_shade(e->vals[Heap->scan]);
+                    }
+                    Heap->scan++;
+                } else {
+                    Heap->npending--;
+                    Heap->scan = 0;
+                }
+            } else {
+                Heap->phase = LGC_SWEEP;
+                Heap->sweep = 0;
+                Heap->swept = 0;
+            }
+        } else {
+            /* Sweep, compacting the survivors to the front */
+            if(Heap->sweep < Heap->nold){
+                lval* v = Heap->old[Heap->sweep++];
+                if(v->mark){
+                    v->mark = 0;
+                    Heap->old[Heap->swept++] = v;
+                } else {
+                    Heap->old_bytes -= lval_bytes(v);
+                    lval_free(v);
+                }
+            } else {
+                Heap->nold = Heap->swept;
+                long held = Heap->nold + Heap->old_bytes / (long)sizeof(lval);
+                Heap->next_major = held * 2 > LGC_MIN ? (int)(held * 2 < INT_MAX ? held * 2 : INT_MAX) : LGC_MIN;
+                Heap->majors++;
+                Heap->phase = LGC_IDLE;
+            }
+        }
+    }
+}
+
+static void lgc_record(long usec){
+    Heap->pauses[Heap->npauses++ % LGC_PAUSES] = usec;
+    if(usec > Heap->max_pause){
+        Heap->max_pause = usec;
+    }
+    Heap->seconds += usec / 1e6;
+}
+
+static int lgc_cmp_pause(const void* a, const void* b){
+    long x = *(const long*)a;
+    long y = *(const long*)b;
+    return (x > y) - (x < y);
+}
+
+/* Pause time at the given percentile of the recent pauses */
+long lgc_pause_pct(double pct){
+    long n = Heap->npauses < LGC_PAUSES ? Heap->npauses : LGC_PAUSES;
+    if(n == 0){
+        return 0;
+    }
+    
+    long* sorted = malloc(sizeof(long) * n);
+    memcpy(sorted, Heap->pauses, sizeof(long) * n);
+    qsort(sorted, n, sizeof(long), lgc_cmp_pause);
+    
+    long i = (long)(pct / 100 * n);
+    long x = sorted[i < n ? i : n - 1];
+    free(sorted);
+    return x;
+}
+
+/* Called from the safe point once nyoung reaches next_gc */
+void lgc_collect(void){
+    clock_t start = clock();
+    
+    if(Heap->nyoung + Heap->young_bytes / (long)sizeof(lval) >= Heap->nursery){
+        lgc_minor();
+        
+        /* Size the nursery so minor pauses fit the budget */
+        long used = (long)((double)(clock() - start) * 1000000 / CLOCKS_PER_SEC);
+        if(used > Heap->budget && Heap->nursery > LGC_NURSERY_MIN){
+            Heap->nursery /= 2;
+        } else if(used < Heap->budget / 4 && Heap->nursery < LGC_NURSERY){
+            Heap->nursery *= 2;
+        }
+    }
+    
+#ifdef BLISP_NO_GENGC
+    lgc_start();
+    lgc_step(-1);
+#else
+    if(Heap->phase == LGC_IDLE && Heap->nold + Heap->old_bytes / (long)sizeof(lval) >= Heap->next_major){
+        lgc_start();
+    }
+    
+    if(Heap->phase != LGC_IDLE){
+        long used = (long)((double)(clock() - start) * 1000000 / CLOCKS_PER_SEC);
+        lgc_step(Heap->budget > used ? Heap->budget - used : 0);
+    }
+#endif
+    
+    /* Come back soon while a major collection is in progress */
+    Heap->next_gc = Heap->nursery;
+    if(Heap->phase != LGC_IDLE && Heap->nyoung + LGC_STEP < Heap->nursery){
+        Heap->next_gc = Heap->nyoung + LGC_STEP;
+    }
+    
+    lgc_record((long)((double)(clock() - start) * 1000000 / CLOCKS_PER_SEC));
+}
+
+/*
+ ** Enviorment Functions
+ **
+ ** Enviorments hold borrowed references. lenv_get returns the bound
+ ** value itself, which is never mutated once bound, so reading a
+ ** variable is O(1) whatever its size.
+ **
+ ** Frames of running lambdas have a parent and count themselves in the
+ ** frames of every symbol they bind. Lookups of symbols no frame binds
+ ** go straight to the top level enviorment.
+ */
+lenv* lenv_new(void){
+    lenv* e = lslab_alloc(&Alloc->envs);
+    e->par = NULL;
+    e->top = e;
+    e->count = 0;
+    e->cap = LENV_INLINE;
+    e->syms = e->inline_syms;
+    e->vals = e->inline_vals;
+    memset(e->inline_syms, 0, sizeof(e->inline_syms));
+    return e;
+}
+
+/* Values are owned by the heap and names by the symbol table,
+ ** only the bindings are freed */
+void lenv_del(lenv* e){
+    if(e->par){
+        lenv_detach(e);
+    }
+    
+    if(e->syms != e->inline_syms){
+        free(e->syms);
+        free(e->vals);
+    }
+    lslab_free(&Alloc->envs, e);
+}
+
+static unsigned long lenv_hash(lsym* sym){
+    unsigned long h = (unsigned long)(size_t)sym;
+    h ^= h >> 17;
+    h *= 0x9E3779B1UL;
+    return h ^ (h >> 15);
+}
+
+/* Slot holding name k in e, or the free slot it would go to. Full inline
+ ** frames return cap */
+static int lenv_slot(lenv* e, lsym* k){
+    if(e->cap == LENV_INLINE){
+        int i = 0;
+        while(i < e->count && e->syms[i] != k){
+            i++;
+        }
+        return i;
+    }
+    
+    unsigned long i = lenv_hash(k) & (e->cap - 1);
+    while(e->syms[i] && e->syms[i] != k){
+        i = (i + 1) & (e->cap - 1);
+    }
+    return (int)i;
+}
+
+/* Move the bindings into a table twice as big, or the first table */
+static void lenv_grow(lenv* e){
+    
+    /* Rehashing moves bindings behind an incremental scan of a top
+     ** level enviorment, so shade them all first */
+    if(!e->par && Heap->phase == LGC_MARK){
+        for(int i = 0; i < e->cap; i++){
+            if(e->syms[i]){
+                lgc_shade(e->vals[i]);
+            }
+        }
+    }
+    
+    lsym** syms = e->syms;
+    lval** vals = e->vals;
+    int cap = e->cap;
+    
+    e->cap = cap == LENV_INLINE ? 4 * LENV_INLINE : 2 * cap;
+    e->syms = calloc(e->cap, sizeof(lsym*));
+    e->vals = malloc(sizeof(lval*) * e->cap);
+    for(int i = 0; i < cap; i++){
+        if(syms[i]){
+            int j = lenv_slot(e, syms[i]);
+            e->syms[j] = syms[i];
+            e->vals[j] = vals[i];
+        }
+    }
+    
+    if(syms != e->inline_syms){
+        free(syms);
+        free(vals);
+    }
+}
+
+/* Value bound to k in e itself, or NULL. *hint caches the slot */
+lval* lenv_find(lenv* e, lsym* k, int* hint){
+    int i = *hint;
+    if(i < e->cap && e->syms[i] == k){
+        return e->vals[i];
+    }
+    
+    i = lenv_slot(e, k);
+    if(i < e->cap && e->syms[i]){
+        *hint = i;
+        return e->vals[i];
+    }
+    return NULL;
+}
+
+lval* lenv_get(lenv* e, lval* k){
+    
+    /* Find key in this enviorment or its parents */
+    if(!k->sym->frames){
+        e = e->top;
+    }
+    for(lenv* p = e; p; p = p->par){
+        int i = lenv_slot(p, k->sym);
+        if(i < p->cap && p->syms[i]){
+            return p->vals[i];
+        }
+    }
+    
+    return lval_err("ERROR: Unbound Symbol '%s'", k->sym->name);
+}
+
+void lenv_put(lenv* e, lval* k, lval* v){
+    
+    int i = lenv_slot(e, k->sym);
+    
+    /* if variables is found assign the new value */
+    if(i < e->cap && e->syms[i]){
+        lgc_shade(e->vals[i]);
+        if(!e->par) { lgc_remember(v); Syms->version++; }
+        e->vals[i] = v;
+        return;
+    }
+    
+    /* Tables are kept at most three quarters full */
+    if(e->cap == LENV_INLINE ? e->count == LENV_INLINE : 4 * (e->count + 1) > 3 * e->cap){
+        lenv_grow(e);
+        i = lenv_slot(e, k->sym);
+    }
+    
+    /* Values and interned names are shared. Minor collections only
+     ** see young values in top level enviorments if remembered */
+    if(!e->par) { lgc_remember(v); Syms->version++; }
+    if(e->par) { k->sym->frames++; }
+    e->vals[i] = v;
+    e->syms[i] = k->sym;
+    e->count++;
+}
+
+/* Bind k, which is not bound in e yet */
+void lenv_push(lenv* e, lsym* k, lval* v){
+    if(e->cap == LENV_INLINE && e->count < LENV_INLINE){
+        if(!e->par) { lgc_remember(v); Syms->version++; }
+        if(e->par) { k->frames++; }
+        e->syms[e->count] = k;
+        e->vals[e->count] = v;
+        e->count++;
+    } else {
+        lval x = { .type = LVAL_SYM, .sym = k };
+        lenv_put(e, &x, v);
+    }
+}
+
+void lenv_def(lenv* e, lval* k, lval* v){
+    lenv_put(e->top, k, v);
+}
+
+/* Detached copy of the bindings of e */
+lenv* lenv_copy(lenv* e){
+    lenv* n = lslab_alloc(&Alloc->envs);
+    
+    n->par = NULL;
+    n->top = n;
+    n->count = e->count;
+    n->cap = e->cap;
+    if(e->cap == LENV_INLINE){
+        n->syms = n->inline_syms;
+        n->vals = n->inline_vals;
+    } else {
+        n->syms = malloc(sizeof(lsym*) * n->cap);
+        n->vals = malloc(sizeof(lval*) * n->cap);
+    }
+    memcpy(n->syms, e->syms, sizeof(lsym*) * n->cap);
+    memcpy(n->vals, e->vals, sizeof(lval*) * n->cap);
+    
+    return n;
+}
+
+/* Running frame for a call made from par, holding the bindings of e if any */
+lenv* lenv_frame(lenv* e, lenv* par){
+    lenv* n = e ? lenv_copy(e) : lenv_new();
+    n->par = par;
+    n->top = par->top;
+    for(int i = 0; i < n->cap; i++){
+        if(n->syms[i]){
+            n->syms[i]->frames++;
+        }
+    }
+    return n;
+}
+
+/* Stop e from being a running frame, e.g. to keep it in a closure */
+void lenv_detach(lenv* e){
+    for(int i = 0; i < e->cap; i++){
+        if(e->syms[i]){
+            e->syms[i]->frames--;
+        }
+    }
+    e->par = NULL;
+    e->top = e;
+}
+
+
+
+/*
+ ** LVAL Functions
+ */
+
+/* Allocate an lval and tag it, payload is filled by the caller */
+static lval* lval_alloc(int type){
+    lval* v = lslab_alloc(&Alloc->lvals);
+    v->type = type;
+    v->mark = 0;
+    v->old = 0;
+    LVEC_PUSH(Heap->young, Heap->nyoung, Heap->young_cap, v);
+    return v;
+}
+
+/* Create a new lval type num*/
+lval* lval_num(int64_t x){
+    lval* v = lval_alloc(LVAL_NUM);
+    v->num = x;
+    return v;
+}
+
+lval* lval_dbl(double x){
+    lval* v = lval_alloc(LVAL_DBL);
+    v->dbl = x;
+    return v;
+}
+
+/* Integer taking over b, a plain number when it fits */
+lval* lval_big(lbig* b){
+    int64_t x;
+    if(lbig_int(b, &x)){
+        lbig_del(b);
+        return lval_num(x);
+    }
+    lval* v = lval_alloc(LVAL_BIG);
+    v->big = b;
+    return v;
+}
+
+/* Vector or Matrix of n numbers left to the caller to fill, or an error
+ ** when n does not fit the count or the numbers can't be allocated */
+static lval* lval_arr(int type, long n){
+    if(n < 0 || n > INT_MAX){
+        return lval_err("%s of %li numbers is too large", ltype_name(type), n);
+    }
+    double* vec = malloc(sizeof(double) * (n ? n : 1));
+    if(!vec){
+        return lval_err("Out of memory for a %s of %li numbers", ltype_name(type), n);
+    }
+    
+    lval* v = lval_alloc(type);
+    v->count = (int)n;
+    v->vec = vec;
+    
+    Heap->young_bytes += lval_bytes(v);
+    if(Heap->nyoung + Heap->young_bytes / (long)sizeof(lval) >= Heap->nursery){
+        Heap->next_gc = Heap->nyoung;
+    }
+    return v;
+}
+
+lval* lval_vec(long n){
+    return lval_arr(LVAL_VEC, n);
+}
+
+lval* lval_mat(int rows, int cols){
+    lval* v = lval_arr(LVAL_MAT, (long)rows * cols);
+    if(v->type == LVAL_ERR){
+        return v;
+    }
+    v->rows = rows;
+    v->cols = cols;
+    return v;
+}
+
+/* Whether v is a Vector or a Matrix */
+static int lval_isarr(lval* v){
+    return v->type == LVAL_VEC || v->type == LVAL_MAT;
+}
+
+/* Whether v is an integer, plain or a bignum */
+static int lval_isint(lval* v){
+    return v->type == LVAL_NUM || v->type == LVAL_BIG;
+}
+
+
+lval* lval_sym(char* s){
+    lval* v = lval_alloc(LVAL_SYM);
+    v->sym = lsym_intern(s);
+    return v;
+}
+
+lval* lval_sexpr(void){
+    lval* v = lval_alloc(LVAL_SEXPR);
+    v->count = 0;
+    v->cell = NULL;
+    v->buf = NULL;
+    return v;
+}
+
+lval* lval_qexpr(void){
+    lval* v = lval_alloc(LVAL_QEXPR);
+    v->count = 0;
+    v->cell = NULL;
+    v->buf = NULL;
+    return v;
+}
+
+lval* lval_fun(lbuiltin func){
+    lval* v = lval_alloc(LVAL_FUN);
+    v->builtin = func;
+    v->lambda = NULL;
+    return v;
+}
+
+/* Special form, func gets its arguments unevaluated */
+lval* lval_form(lbuiltin func){
+    lval* v = lval_alloc(LVAL_FORM);
+    v->builtin = func;
+    v->lambda = NULL;
+    return v;
+}
+
+/* Create a new lval type error*/
+lval* lval_err(char* fmt, ...){
+    
+    lval* v = lval_alloc(LVAL_ERR);
+    
+    va_list va;
+    
+    va_start(va, fmt);
+    
+    /* Allocate space */
+    v->err = malloc(512);
+    
+    vsnprintf(v->err, 511, fmt, va);
+    
+    v->err = realloc(v->err, strlen(v->err)+1);
+    
+    va_end(va);
+    
+    return v;
+}
+
+lval* lval_str(char* s){
+    lval* v = lval_alloc(LVAL_STR);
+    v->str = malloc(strlen(s) + 1);
+    strcpy(v->str, s);
+    return v;
+}
+
+/* Precompute the arity of l, see struct llambda */
+static void llambda_shape(llambda* l){
+    lval* f = l->formals;
+    int n = f->count;
+    
+    l->variadic = n >= 2 && f->cell[n-2]->sym == Syms->rest;
+    l->arity = l->variadic ? n - 2 : n;
+    
+    for(int i = 0; i < n; i++){
+        lsym* k = f->cell[i]->sym;
+        int hint = 0;
+        if(k == Syms->rest ? i != n - 2 : lenv_find(l->env, k, &hint) != NULL){
+            l->arity = -1;
+        }
+        for(int j = 0; j < i; j++){
+            if(f->cell[j]->sym == k){
+                l->arity = -1;
+            }
+        }
+    }
+}
+
+lval* lval_lambda(lval* formals, lval* body){
+    lval* v = lval_alloc(LVAL_FUN);
+    
+    /* Set builtin to NULL */
+    v->builtin = NULL;
+    
+    /* Lambda state lives out of line to keep every lval small */
+    v->lambda = malloc(sizeof(llambda));
+    
+    /* Build new enviorment */
+    v->lambda->env = lenv_new();
+    
+    /* Set Formals and body */
+    v->lambda->formals = formals;
+    v->lambda->body = body;
+    v->lambda->code = NULL;
+    llambda_shape(v->lambda);
+    
+    return v;
+    
+}
+
+/* Free v itself, the values it points to are left to the collector */
+static void lval_free(lval* v){
+    
+    switch(v->type){
+        case LVAL_NUM:
+        case LVAL_DBL:
+        case LVAL_SYM:
+        case LVAL_FORM:
+            /* Symbol names belong to the symbol table */
+            break;
+        case LVAL_ERR:
+            free(v->err);
+            break;
+        case LVAL_BIG:
+            lbig_del(v->big);
+            break;
+        case LVAL_VEC:
+        case LVAL_MAT:
+            free(v->vec);
+            break;
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+            lcells_release(v->buf);
+            break;
+        case LVAL_FUN:
+            if(!v->builtin){
+                lenv_del(v->lambda->env);
+                if(v->lambda->code){
+                    lcode_del(v->lambda->code);
+                }
+                free(v->lambda);
+            }
+            break;
+        case LVAL_STR:
+            if(v->str){
+                free(v->str);
+            }
+            break;
+    }
+    
+    lslab_free(&Alloc->lvals, v);
+}
+
+/* Values are never mutated once reachable, so a copy is v itself. A
+ ** list copy is a new header sharing v's cell buffer, lval_add and
+ ** lval_pop copy the buffer before writing to a shared one. The buffer
+ ** only counts the headers using it, cycles through lambda enviorments
+ ** are left to the collector. */
+lval* lval_copy(lval* v){
+    
+    if(v->type != LVAL_SEXPR && v->type != LVAL_QEXPR){
+        return v;
+    }
+    
+    lval* x = lval_alloc(v->type);
+    x->count = v->count;
+    x->cell = v->cell;
+    x->buf = v->buf;
+    if(x->buf){
+        x->buf->refs++;
+    }
+    
+    return x;
+}
+
+/* Make v the only user of a buffer with room for n cells from v->cell.
+ ** Buffers grow by doubling, so reserving ahead of bulk appends is optional */
+void lval_reserve(lval* v, int n){
+    lcells* b = v->buf;
+    if(n == 0){
+        return;
+    }
+    
+    if(b && b->refs == 1){
+        int start = v->cell - b->items;
+        if(start + n <= b->cap){
+            return;
+        }
+        
+        /* Slide the cells back over the slots popped from the front */
+        if(n <= b->cap && start >= v->count){
+            memcpy(b->items, v->cell, sizeof(lval*) * v->count);
+            v->cell = b->items;
+            return;
+        }
+    }
+    
+    /* Growing at least doubles, so a queue's front pops are paid for */
+    if(b && n > v->count && n < 2 * v->count){
+        n = 2 * v->count;
+    }
+    
+    lcells* x = lcells_new(n);
+    if(v->count){
+        memcpy(x->items, v->cell, sizeof(lval*) * v->count);
+    }
+    lcells_release(b);
+    
+    v->buf = x;
+    v->cell = x->items;
+}
+
+lval* lval_add(lval* v, lval* x){
+    if(v->old){
+        lgc_remember(x);
+    }
+    lval_reserve(v, v->count + 1);
+    v->cell[v->count] = x;
+    v->count++;
+    return v;
+}
+
+
+
+/* Output lval_print has yet to write, a value or else the character c.
+ ** Lists queue their cells in turn, so deeply nested lists print from a
+ ** heap allocated stack instead of recursing */
+typedef struct lpending {
+    lval* v;
+    char c;
+} lpending;
+
+/* Queue the cells of v followed by close, the first one on top */
+static void lval_print_cells(lpending** todo, int* n, int* cap, lval* v, char close){
+    LVEC_PUSH(*todo, *n, *cap, ((lpending){ NULL, close }));
+    for(int i = v->count - 1; i >= 0; i--){
+        LVEC_PUSH(*todo, *n, *cap, ((lpending){ v->cell[i], 0 }));
+        
+        /* Space between cells */
+        if(i > 0){
+            LVEC_PUSH(*todo, *n, *cap, ((lpending){ NULL, ' ' }));
+        }
+    }
+}
+
+/* Print the queued output, last in first out, and free the queue */
+static void lval_print_queued(lpending* todo, int n, int cap){
+    while(n > 0){
+        lpending p = todo[--n];
+        lval* v = p.v;
+        if(!v){
+            putchar(p.c);
+            continue;
+        }
+        
+        switch(v->type){
+                /* if lval type is a number use regular printf */
+            case LVAL_NUM:
+                printf("%lld", (long long)v->num);
+                break;
+            case LVAL_DBL:
+                printf("%f", v->dbl);
+                break;
+            case LVAL_BIG: {
+                char* s = malloc(lbig_strlen(v->big));
+                lbig_str(v->big, s);
+                fputs(s, stdout);
+                free(s);
+                break;
+            }
+            case LVAL_VEC:
+                putchar('[');
+                for(int i = 0; i < v->count; i++){
+                    printf(i ? " %f" : "%f", v->vec[i]);
+                }
+                putchar(']');
+                break;
+            case LVAL_MAT:
+                putchar('[');
+                for(int i = 0; i < v->rows; i++){
+                    fputs(i ? " [" : "[", stdout);
+                    for(int j = 0; j < v->cols; j++){
+                        printf(j ? " %f" : "%f", v->vec[i * v->cols + j]);
+                    }
+                    putchar(']');
+                }
+                putchar(']');
+                break;
+                /* if lval is an error print the appropriate error message*/
+            case LVAL_ERR:
+                printf("ERROR: %s", v->err);
+                break;
+            case LVAL_SYM:
+                printf("%s", v->sym->name);
+                break;
+            case LVAL_SEXPR:
+                putchar('(');
+                lval_print_cells(&todo, &n, &cap, v, ')');
+                break;
+            case LVAL_QEXPR:
+                putchar('{');
+                lval_print_cells(&todo, &n, &cap, v, '}');
+                break;
+            case LVAL_FORM:
+                printf("<builtin>");
+                break;
+            case LVAL_FUN:
+                if(v->builtin){
+                    printf("<builtin>");
+                } else {
+                    printf("\\ ");
+                    LVEC_PUSH(todo, n, cap, ((lpending){ NULL, ')' }));
+                    LVEC_PUSH(todo, n, cap, ((lpending){ v->lambda->body, 0 }));
+                    LVEC_PUSH(todo, n, cap, ((lpending){ NULL, ' ' }));
+                    LVEC_PUSH(todo, n, cap, ((lpending){ v->lambda->formals, 0 }));
+                }
+                break;
+            case LVAL_STR:
+                lval_print_str(v);
+                break;
+        }
+    }
+    
+    free(todo);
+}
+
+void lval_expr_print(lval* v, char open, char close){
+    lpending* todo = NULL;
+    int n = 0;
+    int cap = 0;
+    
+    putchar(open);
+    lval_print_cells(&todo, &n, &cap, v, close);
+    lval_print_queued(todo, n, cap);
+}
+
+void lval_print(lval* v){
+    lpending* todo = NULL;
+    int n = 0;
+    int cap = 0;
+    
+    LVEC_PUSH(todo, n, cap, ((lpending){ v, 0 }));
+    lval_print_queued(todo, n, cap);
+}
+
+void lval_print_str(lval* v){
+    
+    char* escaped = malloc(strlen(v->str)+1);
+    strcpy(escaped, v->str);
+    
+    escaped = mpcf_escape(escaped);
+    
+    printf("\"%s\"", escaped);
+    
+    free(escaped);
+}
+
+void lval_println(lval* v){
+    lval_print(v);
+    putchar('\n');
+}
+
+lval* lval_pop(lval* v, int i){
+    
+    lval* x = v->cell[i];
+    lgc_shade(x);
+    
+    // The ends only narrow the view, even of a shared buffer
+    if(i == 0){
+        v->cell++;
+    } else if(i != v->count - 1){
+        // Copy the cells if they are shared, then shift memory
+        lval_reserve(v, v->count);
+        memmove(&v->cell[i], &v->cell[i+1], sizeof(lval*) * (v->count-i-1));
+    }
+    
+    // Decrease count
+    v->count--;
+    
+    return x;
+}
+
+lval* builtin_add(lenv* e, lval* a){
+    return builtin_op(e, a, LPRIM_ADD);
+}
+
+lval* builtin_sub(lenv* e, lval* a){
+    return builtin_op(e, a, LPRIM_SUB);
+}
+
+lval* builtin_mul(lenv* e, lval* a){
+    return builtin_op(e, a, LPRIM_MUL);
+}
+
+lval* builtin_div(lenv* e, lval* a){
+    return builtin_op(e, a, LPRIM_DIV);
+}
+
+lval* builtin_op(lenv* e, lval* a, int op){
+    
+    /* Ensure all arguments are numbers */
+    int vec = 0;
+    for(int i = 0; i < a->count; i++ ){
+        LASSERT(a, (lval_isint(a->cell[i]) || a->cell[i]->type == LVAL_DBL || lval_isarr(a->cell[i])),
+                "Function '%s' passed incorrect types for argument %i. Got %s, Expected %s or %s",
+                lprim_names[op],
+                i,
+                ltype_name(a->cell[i]->type),
+                ltype_name(LVAL_NUM),ltype_name(LVAL_DBL));
+        vec |= lval_isarr(a->cell[i]);
+    }
+    
+    if(vec){
+        return lval_vec_op(op, a->cell, a->count);
+    }
+    return builtin_op_cells(op, a->cell, a->count);
+}
+
+/* Number v as a double */
+static double lnum_dbl(lval* v){
+    switch(v->type){
+        case LVAL_NUM: return (double)v->num;
+        case LVAL_BIG: return lbig_dbl(v->big);
+    }
+    return v->dbl;
+}
+
+/* Integer v as a bignum, a new one unless v is a bignum */
+static lbig* lnum_big(lval* v){
+    return v->type == LVAL_BIG ? v->big : lbig_from_int(v->num);
+}
+
+/* Exact op on two integers into *r. Returns 1, 0 when the result is no
+ ** integer, or -1 when it overflows */
+static int lint_op(int op, int64_t x, int64_t y, int64_t* r){
+    switch(op){
+#ifdef __GNUC__
+        case LPRIM_ADD: return __builtin_add_overflow(x, y, r) ? -1 : 1;
+        case LPRIM_SUB: return __builtin_sub_overflow(x, y, r) ? -1 : 1;
+        case LPRIM_MUL: return __builtin_mul_overflow(x, y, r) ? -1 : 1;
+#else
+        case LPRIM_ADD:
+            if(y > 0 ? x > INT64_MAX - y : x < INT64_MIN - y){
+                return -1;
+            }
+            *r = x + y;
+            return 1;
+        case LPRIM_SUB:
+            if(y < 0 ? x > INT64_MAX + y : x < INT64_MIN + y){
+                return -1;
+            }
+            *r = x - y;
+            return 1;
+        case LPRIM_MUL:
+            if(x > 0 ? (y > 0 ? x > INT64_MAX / y : y < INT64_MIN / x)
+                     : (y > 0 ? x < INT64_MIN / y : x != 0 && y < INT64_MAX / x)){
+                return -1;
+            }
+            *r = x * y;
+            return 1;
+#endif
+        case LPRIM_DIV:
+            if(y == 0 || x % (y == -1 ? 1 : y) != 0){
+                return 0;
+            }
+            if(x == INT64_MIN && y == -1){
+                return -1;
+            }
+            *r = x / y;
+            return 1;
+    }
+    return 0;
+}
+
+/* Kernels folding the numbers of cell[i..n-1] into x */
+static double lprim_add(double x, lval** cell, int i, int n){
+    for(; i < n; i++){ x += lnum_dbl(cell[i]); }
+    return x;
+}
+
+static double lprim_sub(double x, lval** cell, int i, int n){
+    for(; i < n; i++){ x -= lnum_dbl(cell[i]); }
+    return x;
+}
+
+static double lprim_mul(double x, lval** cell, int i, int n){
+    for(; i < n; i++){ x *= lnum_dbl(cell[i]); }
+    return x;
+}
+
+static double lprim_div(double x, lval** cell, int i, int n){
+    for(; i < n; i++){ x /= lnum_dbl(cell[i]); }
+    return x;
+}
+
+/* Doubles hold every integer up to 2^53 exactly */
+#define LINT_EXACT 9007199254740992.0
+
+/* Fold op over n numbers. Integers fold exactly, as bignums past int64,
+ ** while the results are integers, the rest folds as doubles */
+lval* builtin_op_cells(int op, lval** cell, int n){
+    
+    int64_t r;
+    if(n == 2 && cell[0]->type == LVAL_NUM && cell[1]->type == LVAL_NUM
+       && lint_op(op, cell[0]->num, cell[1]->num, &r) > 0){
+        // Two integers, the common case
+        return lval_num(r);
+    }
+    
+    if(op == LPRIM_DIV){
+        for(int i = 1; i < n; i++){
+            if(lnum_dbl(cell[i]) == 0){
+                return lval_err("Division By Zero!");
+            }
+        }
+    }
+    
+    // Arguments may be shared, accumulate into a new number
+    int i = 1;
+    int exact = 1;
+    double x = 0;
+    lbig* b = NULL;
+    if(cell[0]->type == LVAL_NUM){
+        int64_t k = cell[0]->num;
+        int ok = 1;
+        if(n == 1){
+            // if no arguments perform unary op
+            if(op != LPRIM_SUB){
+                return lval_num(k);
+            }
+            if(k != INT64_MIN){
+                return lval_num(-k);
+            }
+            ok = -1;
+        }
+        
+        while(i < n && cell[i]->type == LVAL_NUM && (ok = lint_op(op, k, cell[i]->num, &r)) > 0){
+            k = r;
+            i++;
+        }
+        if(i == n && ok > 0){
+            return lval_num(k);
+        }
+        
+        // Past an overflow the integers carry on as a bignum
+        if(ok < 0 || cell[i]->type == LVAL_BIG){
+            b = lbig_from_int(k);
+        } else {
+            x = (double)k;
+        }
+    } else if(cell[0]->type == LVAL_BIG){
+        b = lbig_dup(cell[0]->big, 1);
+    } else {
+        x = cell[0]->dbl;
+    }
+    
+    if(b){
+        if(n == 1){
+            b->sign = op == LPRIM_SUB ? -b->sign : b->sign;
+            return lval_big(b);
+        }
+        
+        while(i < n && lval_isint(cell[i])){
+            lbig* y = lnum_big(cell[i]);
+            lbig* t = NULL;
+            switch(op){
+                case LPRIM_ADD: t = lbig_add(b, y, 0); break;
+                case LPRIM_SUB: t = lbig_add(b, y, 1); break;
+                case LPRIM_MUL: t = lbig_mul(b, y); break;
+                case LPRIM_DIV: {
+                    lbig* m = NULL;
+                    t = lbig_div(b, y, &m);
+                    if(m->count){
+                        // Not a whole quotient, the rest folds as doubles
+                        lbig_del(t);
+                        t = NULL;
+                        x = lbig_ratio(b, y);
+                    }
+                    lbig_del(m);
+                    break;
+                }
+            }
+            if(cell[i]->type == LVAL_NUM){
+                lbig_del(y);
+            }
+            lbig_del(b);
+            b = t;
+            i++;
+            if(!b){
+                break;
+            }
+        }
+        if(b && i == n){
+            return lval_big(b);
+        }
+        if(b){
+            x = lbig_dbl(b);
+            lbig_del(b);
+        }
+        
+        // Past a bignum the result is never narrowed back
+        exact = 0;
+    }
+    
+    if(n == 1 && op == LPRIM_SUB){
+        x = -x;
+    } else {
+        switch(op){
+            case LPRIM_ADD: x = lprim_add(x, cell, i, n); break;
+            case LPRIM_SUB: x = lprim_sub(x, cell, i, n); break;
+            case LPRIM_MUL: x = lprim_mul(x, cell, i, n); break;
+            case LPRIM_DIV: x = lprim_div(x, cell, i, n); break;
+        }
+    }
+    
+    // A whole result keeps the type of the first operand
+    if(cell[0]->type == LVAL_NUM && exact && x == floor(x) && fabs(x) <= LINT_EXACT){
+        return lval_num((int64_t)x);
+    }
+    
+    return lval_dbl(x);
+}
+
+/* Sign of x - y for integers x and y */
+static int lnum_cmp(lval* x, lval* y){
+    if(x->type == LVAL_NUM && y->type == LVAL_NUM){
+        return (x->num > y->num) - (x->num < y->num);
+    }
+    lbig* a = lnum_big(x);
+    lbig* b = lnum_big(y);
+    int c = lbig_cmp(a, b);
+    if(x->type == LVAL_NUM){
+        lbig_del(a);
+    }
+    if(y->type == LVAL_NUM){
+        lbig_del(b);
+    }
+    return c;
+}
+
+/* Comparison op of two numbers */
+static int lprim_ord(int op, int64_t x, int64_t y){
+    switch(op){
+        case LPRIM_LT:  return x < y;
+        case LPRIM_GT:  return x > y;
+        case LPRIM_LTE: return x <= y;
+        case LPRIM_GTE: return x >= y;
+    }
+    return 0;
+}
+
+lval* builtin_ord(lenv* e, lval* a, int op){
+    
+    LASSERT_ARGS(lprim_names[op], a, 2);
+    if(a->cell[0]->type == LVAL_NUM && a->cell[1]->type == LVAL_NUM){
+        return lval_num(lprim_ord(op, a->cell[0]->num, a->cell[1]->num));
+    }
+    if(lval_isarr(a->cell[0]) || lval_isarr(a->cell[1])){
+        return builtin_op(e, a, op);
+    }
+    for(int i = 0; i < 2; i++){
+        LASSERT(a, lval_isint(a->cell[i]),
+                "Function '%s' passed incorrect types for argument %i. Got %s, Expected %s",
+                lprim_names[op], i, ltype_name(a->cell[i]->type), ltype_name(LVAL_NUM));
+    }
+    
+    return lval_num(lprim_ord(op, lnum_cmp(a->cell[0], a->cell[1]), 0));
+}
+
+lval* builtin_gt(lenv* e, lval* a){
+    return builtin_ord(e, a, LPRIM_GT);
+}
+
+lval* builtin_lt(lenv* e, lval* a){
+    return builtin_ord(e, a, LPRIM_LT);
+}
+
+lval* builtin_gte(lenv* e, lval* a){
+    return builtin_ord(e, a, LPRIM_GTE);
+}
+
+lval* builtin_lte(lenv* e, lval* a){
+    return builtin_ord(e, a, LPRIM_LTE);
+}
+
+lval* builtin_cmp(lenv* e, lval* a, int op){
+    LASSERT_ARGS(lprim_names[op], a, 2);
+    
+    int r = lval_eq(a->cell[0], a->cell[1]) == (op == LPRIM_EQ);
+    
+    return lval_num(r);
+}
+
+lval* builtin_eq(lenv* e, lval* a){
+    return builtin_cmp(e, a, LPRIM_EQ);
+}
+
+lval* builtin_ne(lenv* e, lval* a){
+    return builtin_cmp(e, a, LPRIM_NE);
+}
+
+/*
+ ** Vector Builtins
+ **
+ ** Vectors are unboxed numbers, as doubles, and matrices the same laid
+ ** out row after row. Arithmetic maps over them and the numbers passed
+ ** along, the ordering builtins give masks of 1 and 0. Division follows
+ ** IEEE as for doubles, so dividing by zero gives inf or nan rather
+ ** than an error.
+ */
+
+/* Numbers of v for a map, a vector's or v repeated through *tmp */
+static const double* lvec_operand(lval* v, double* tmp, long* stride){
+    if(lval_isarr(v)){
+        *stride = 1;
+        return v->vec;
+    }
+    *tmp = lnum_dbl(v);
+    *stride = 0;
+    return tmp;
+}
+
+/* Fold op over numbers and at least one vector or matrix, those all of
+ ** one type and shape */
+lval* lval_vec_op(int op, lval** cell, int n){
+    int f = -1;
+    for(int i = 0; i < n; i++){
+        if(!lval_isarr(cell[i])){
+            continue;
+        }
+        if(f < 0){
+            f = i;
+        }
+        lval* x = cell[f];
+        lval* y = cell[i];
+        if(x->type != y->type){
+            return lval_err("Function '%s' passed a %s and a %s",
+                            lprim_names[op], ltype_name(x->type), ltype_name(y->type));
+        }
+        if(x->type == LVAL_MAT && (x->rows != y->rows || x->cols != y->cols)){
+            return lval_err("Function '%s' passed matrices of %ix%i and %ix%i",
+                            lprim_names[op], x->rows, x->cols, y->rows, y->cols);
+        }
+        if(x->count != y->count){
+            return lval_err("Function '%s' passed vectors of length %i and %i",
+                            lprim_names[op], x->count, y->count);
+        }
+    }
+    
+    if(n == 1 && op != LPRIM_SUB){
+        return cell[0];
+    }
+    
+    // Numbers ahead of the first vector fold on their own, negation is 0 - v
+    double x = 0;
+    if(f > 0){
+        lval* s = f > 1 ? builtin_op_cells(op, cell, f) : cell[0];
+        if(s->type == LVAL_ERR){
+            return s;
+        }
+        x = lnum_dbl(s);
+    }
+    
+    long len = cell[f]->count;
+    lval* r = cell[f]->type == LVAL_MAT ? lval_mat(cell[f]->rows, cell[f]->cols) : lval_vec(len);
+    if(r->type == LVAL_ERR){
+        return r;
+    }
+    int lead = f > 0 || n == 1;
+    const double* xp = lead ? &x : cell[0]->vec;
+    long xs = lead ? 0 : 1;
+    for(int i = lead ? f : 1; i < n; i++){
+        double t;
+        long ys;
+        const double* yp = lvec_operand(cell[i], &t, &ys);
+        lvec_k.map(op, r->vec, xp, xs, yp, ys, len);
+        xp = r->vec;
+        xs = 1;
+    }
+    return r;
+}
+
+lval* builtin_vec(lenv* e, lval* a){
+    LASSERT_ARGS("vec", a, 1);
+    
+    // A matrix flattens to its rows one after another
+    if(a->cell[0]->type == LVAL_MAT){
+        lval* v = lval_vec(a->cell[0]->count);
+        if(v->type == LVAL_ERR){
+            return v;
+        }
+        memcpy(v->vec, a->cell[0]->vec, sizeof(double) * v->count);
+        return v;
+    }
+    LASSERT_TYPE("vec", a, 0, LVAL_QEXPR);
+    
+    lval* q = a->cell[0];
+    for(int i = 0; i < q->count; i++){
+        LASSERT(a, (lval_isint(q->cell[i]) || q->cell[i]->type == LVAL_DBL),
+                "Function 'vec' passed a list holding %s at %i, Expected %s",
+                ltype_name(q->cell[i]->type), i, ltype_name(LVAL_NUM));
+    }
+    
+    lval* v = lval_vec(q->count);
+    if(v->type == LVAL_ERR){
+        return v;
+    }
+    for(int i = 0; i < q->count; i++){
+        v->vec[i] = lnum_dbl(q->cell[i]);
+    }
+    return v;
+}
+
+lval* builtin_vec_list(lenv* e, lval* a){
+    LASSERT_ARGS("vec-list", a, 1);
+    LASSERT_TYPE("vec-list", a, 0, LVAL_VEC);
+    
+    lval* v = a->cell[0];
+    lval* q = lval_qexpr();
+    lval_reserve(q, v->count);
+    for(int i = 0; i < v->count; i++){
+        lval_add(q, lval_dbl(v->vec[i]));
+    }
+    return q;
+}
+
+/* Vector of 0 to n - 1 */
+lval* builtin_vec_range(lenv* e, lval* a){
+    LASSERT_ARGS("vec-range", a, 1);
+    LASSERT_TYPE("vec-range", a, 0, LVAL_NUM);
+    LASSERT(a, (a->cell[0]->num >= 0 && a->cell[0]->num <= INT_MAX),
+            "Function 'vec-range' passed a length of %lld", (long long)a->cell[0]->num);
+    
+    lval* v = lval_vec((long)a->cell[0]->num);
+    if(v->type == LVAL_ERR){
+        return v;
+    }
+    for(int i = 0; i < v->count; i++){
+        v->vec[i] = i;
+    }
+    return v;
+}
+
+lval* builtin_vec_len(lenv* e, lval* a){
+    LASSERT_ARGS("vec-len", a, 1);
+    LASSERT_TYPE("vec-len", a, 0, LVAL_VEC);
+    
+    return lval_num(a->cell[0]->count);
+}
+
+lval* builtin_sum(lenv* e, lval* a){
+    LASSERT_ARGS("sum", a, 1);
+    LASSERT_ARR("sum", a, 0);
+    
+    return lval_dbl(lvec_k.sum(a->cell[0]->vec, NULL, a->cell[0]->count));
+}
+
+lval* builtin_dot(lenv* e, lval* a){
+    LASSERT_ARGS("dot", a, 2);
+    LASSERT_TYPE("dot", a, 0, LVAL_VEC);
+    LASSERT_TYPE("dot", a, 1, LVAL_VEC);
+    LASSERT(a, (a->cell[0]->count == a->cell[1]->count),
+            "Function 'dot' passed vectors of length %i and %i", a->cell[0]->count, a->cell[1]->count);
+    
+    return lval_dbl(lvec_k.sum(a->cell[0]->vec, a->cell[1]->vec, a->cell[0]->count));
+}
+
+lval* builtin_extreme(lenv* e, lval* a, char* func, int max){
+    LASSERT_ARGS(func, a, 1);
+    LASSERT_ARR(func, a, 0);
+    LASSERT(a, (a->cell[0]->count != 0), "Function '%s' passed an empty %s!", func, ltype_name(a->cell[0]->type));
+    
+    return lval_dbl(lvec_k.extreme(a->cell[0]->vec, a->cell[0]->count, max));
+}
+
+lval* builtin_min(lenv* e, lval* a){
+    return builtin_extreme(e, a, "min", 0);
+}
+
+lval* builtin_max(lenv* e, lval* a){
+    return builtin_extreme(e, a, "max", 1);
+}
+
+/* Matrix of a Q-Expression of rows, each a Q-Expression of numbers */
+lval* builtin_mat(lenv* e, lval* a){
+    LASSERT_ARGS("mat", a, 1);
+    LASSERT_TYPE("mat", a, 0, LVAL_QEXPR);
+    
+    lval* q = a->cell[0];
+    for(int i = 0; i < q->count; i++){
+        lval* row = q->cell[i];
+        LASSERT(a, (row->type == LVAL_QEXPR),
+                "Function 'mat' passed a row of type %s at %i, Expected %s",
+                ltype_name(row->type), i, ltype_name(LVAL_QEXPR));
+        LASSERT(a, (row->count == q->cell[0]->count),
+                "Function 'mat' passed rows of length %i and %i", q->cell[0]->count, row->count);
+        for(int j = 0; j < row->count; j++){
+            LASSERT(a, (lval_isint(row->cell[j]) || row->cell[j]->type == LVAL_DBL),
+                    "Function 'mat' passed a row holding %s at %i, Expected %s",
+                    ltype_name(row->cell[j]->type), j, ltype_name(LVAL_NUM));
+        }
+    }
+    
+    int cols = q->count ? q->cell[0]->count : 0;
+    lval* m = lval_mat(q->count, cols);
+    if(m->type == LVAL_ERR){
+        return m;
+    }
+    for(int i = 0; i < q->count; i++){
+        for(int j = 0; j < cols; j++){
+            m->vec[(long)i * cols + j] = lnum_dbl(q->cell[i]->cell[j]);
+        }
+    }
+    return m;
+}
+
+lval* builtin_mat_list(lenv* e, lval* a){
+    LASSERT_ARGS("mat-list", a, 1);
+    LASSERT_TYPE("mat-list", a, 0, LVAL_MAT);
+    
+    lval* m = a->cell[0];
+    lval* q = lval_qexpr();
+    lval_reserve(q, m->rows);
+    for(int i = 0; i < m->rows; i++){
+        lval* row = lval_qexpr();
+        lval_reserve(row, m->cols);
+        for(int j = 0; j < m->cols; j++){
+            lval_add(row, lval_dbl(m->vec[(long)i * m->cols + j]));
+        }
+        lval_add(q, row);
+    }
+    return q;
+}
+
+/* Matrix of rows by cols holding the numbers of a vector or matrix */
+lval* builtin_reshape(lenv* e, lval* a){
+    LASSERT_ARGS("reshape", a, 3);
+    LASSERT_ARR("reshape", a, 0);
+    LASSERT_TYPE("reshape", a, 1, LVAL_NUM);
+    LASSERT_TYPE("reshape", a, 2, LVAL_NUM);
+    
+    lval* x = a->cell[0];
+    int64_t rows = a->cell[1]->num;
+    int64_t cols = a->cell[2]->num;
+    LASSERT(a, (rows >= 0 && cols >= 0 && rows <= INT_MAX && cols <= INT_MAX && rows * cols == x->count),
+            "Function 'reshape' passed %i numbers for %lldx%lld",
+            x->count, (long long)rows, (long long)cols);
+    
+    lval* m = lval_mat((int)rows, (int)cols);
+    if(m->type == LVAL_ERR){
+        return m;
+    }
+    memcpy(m->vec, x->vec, sizeof(double) * x->count);
+    return m;
+}
+
+/* {rows cols} of a matrix, {length} of a vector */
+lval* builtin_shape(lenv* e, lval* a){
+    LASSERT_ARGS("shape", a, 1);
+    LASSERT_ARR("shape", a, 0);
+    
+    lval* x = a->cell[0];
+    lval* q = lval_qexpr();
+    if(x->type == LVAL_MAT){
+        lval_add(q, lval_num(x->rows));
+        lval_add(q, lval_num(x->cols));
+    } else {
+        lval_add(q, lval_num(x->count));
+    }
+    return q;
+}
+
+/* Tiles transposed at a time, so the rows both sides touch stay cached */
+#define LMAT_TILE 32
+
+lval* builtin_transpose(lenv* e, lval* a){
+    LASSERT_ARGS("transpose", a, 1);
+    LASSERT_TYPE("transpose", a, 0, LVAL_MAT);
+    
+    lval* m = a->cell[0];
+    lval* t = lval_mat(m->cols, m->rows);
+    if(t->type == LVAL_ERR){
+        return t;
+    }
+    for(int i0 = 0; i0 < m->rows; i0 += LMAT_TILE){
+        int i1 = m->rows - i0 < LMAT_TILE ? m->rows : i0 + LMAT_TILE;
+        for(int j0 = 0; j0 < m->cols; j0 += LMAT_TILE){
+            int j1 = m->cols - j0 < LMAT_TILE ? m->cols : j0 + LMAT_TILE;
+            for(int i = i0; i < i1; i++){
+                for(int j = j0; j < j1; j++){
+                    t->vec[(long)j * m->rows + i] = m->vec[(long)i * m->cols + j];
+                }
+            }
+        }
+    }
+    return t;
+}
+
+#ifdef BLISP_NAIVE_MATMUL
+/* Textbook triple loop, to compare the blocked kernels against */
+static void lmat_naive(double* c, const double* a, const double* b, long m, long k, long n){
+    for(long i = 0; i < m; i++){
+        for(long j = 0; j < n; j++){
+            double s = 0;
+            for(long p = 0; p < k; p++){
+                s += a[i * k + p] * b[p * n + j];
+            }
+            c[i * n + j] = s;
+        }
+    }
+}
+#endif
+
+/* Matrix product, a vector multiplies as a row on the left and as a
+ ** column on the right */
+lval* builtin_matmul(lenv* e, lval* a){
+    LASSERT_ARGS("matmul", a, 2);
+    LASSERT_ARR("matmul", a, 0);
+    LASSERT_ARR("matmul", a, 1);
+    
+    lval* x = a->cell[0];
+    lval* y = a->cell[1];
+    LASSERT(a, (x->type == LVAL_MAT || y->type == LVAL_MAT),
+            "Function 'matmul' passed two vectors, Expected a %s", ltype_name(LVAL_MAT));
+    
+    long m = x->type == LVAL_MAT ? x->rows : 1;
+    long k = x->type == LVAL_MAT ? x->cols : x->count;
+    long kb = y->type == LVAL_MAT ? y->rows : y->count;
+    long n = y->type == LVAL_MAT ? y->cols : 1;
+    LASSERT(a, (k == kb), "Function 'matmul' passed %lix%li and %lix%li", m, k, kb, n);
+    LASSERT(a, (m * n <= INT_MAX), "Function 'matmul' passed %lix%li and %lix%li", m, k, kb, n);
+    
+    lval* r = x->type == LVAL_MAT && y->type == LVAL_MAT ? lval_mat((int)m, (int)n) : lval_vec(m * n);
+    if(r->type == LVAL_ERR){
+        return r;
+    }
+    memset(r->vec, 0, sizeof(double) * m * n);
+#ifdef BLISP_NAIVE_MATMUL
+    lmat_naive(r->vec, x->vec, y->vec, m, k, n);
+#else
+    lvec_k.gemm(r->vec, x->vec, y->vec, m, k, n);
+#endif
+    return r;
+}
+
+/* Arguments of a special form evaluated as for a builtin, or the first
+ ** error among them */
+static lval* lval_eval_args(lenv* e, lval* a){
+    lval* x = lval_sexpr();
+    lval_reserve(x, a->count);
+    lgc_root(x);
+    for(int i = 0; i < a->count; i++){
+        lval_add(x, lval_eval(e, a->cell[i]));
+    }
+    lgc_unroot(1);
+    
+    for(int i = 0; i < x->count; i++){
+        if(x->cell[i]->type == LVAL_ERR){
+            return x->cell[i];
+        }
+    }
+    return x;
+}
+
+/* Error for an evaluated condition of if, NULL when c is a number */
+lval* lval_cond_err(lval* c){
+    if(lval_isint(c) || c->type == LVAL_ERR){
+        return NULL;
+    }
+    return lval_err("Function '%s' passed incorrect types for argument %i. Got %s, Expected %s",
+                    "if", 0, ltype_name(c->type), ltype_name(LVAL_NUM));
+}
+
+/* Numbers equal to zero are false, everything else is true */
+int lval_truthy(lval* v){
+    return !((v->type == LVAL_NUM && v->num == 0) || (v->type == LVAL_DBL && v->dbl == 0));
+}
+
+/* Q-Expressions evaluate as S-Expressions, anything else as itself */
+static lval* lval_eval_branch(lenv* e, lval* v){
+    if(v->type == LVAL_QEXPR){
+        return lval_eval_sexpr(e, v);
+    }
+    return lval_eval(e, v);
+}
+
+/* Special form, only the branch taken is evaluated */
+lval* builtin_if(lenv* e, lval* a){
+    if(a->count != 3){
+        lval* x = lval_eval_args(e, a);
+        if(x->type == LVAL_ERR){
+            return x;
+        }
+        LASSERT_ARGS("if", x, 3);
+    }
+    
+    lval* c = lval_eval(e, a->cell[0]);
+    lval* err = lval_cond_err(c);
+    if(c->type == LVAL_ERR || err){
+        return err ? err : c;
+    }
+    
+    if(lval_truthy(c)){
+        /* If condition is true, evaluate first */
+        return lval_eval_branch(e, a->cell[1]);
+    } else {
+        /* Otherwise evalute second expression */
+        return lval_eval_branch(e, a->cell[2]);
+    }
+}
+
+lval* builtin_head(lenv* e, lval* a){
+    
+    // Check for errors
+    LASSERT_ARGS("head", a, 1);
+    LASSERT_TYPE("head", a, 0, LVAL_QEXPR);
+    LASSERT(a, (a->cell[0]->count != 0), "Function 'head' passed {}!");
+    
+    
+    // Share the cell buffer, keeping only the first element
+    lval* v = lval_copy(a->cell[0]);
+    v->count = 1;
+    return v;
+}
+
+lval* builtin_tail(lenv* e, lval* a){
+    
+    // Check for errors
+    LASSERT_ARGS("tail", a, 1);
+    LASSERT_TYPE("tail", a, 0, LVAL_QEXPR);
+    LASSERT(a, (a->cell[0]->count != 0), "Function 'tail' passed {}!");
+    
+    
+    // Share the cell buffer, skipping the first element
+    lval* v = lval_copy(a->cell[0]);
+    v->cell++;
+    v->count--;
+    return v;
+}
+
+lval* builtin_list(lenv* e, lval* a){
+    a->type = LVAL_QEXPR;
+    return a;
+}
+
+lval* builtin_eval(lenv* e, lval* a){
+    LASSERT_ARGS("eval", a, 1);
+    LASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
+    
+    return lval_eval_sexpr(e, a->cell[0]);
+}
+
+lval* lval_join_str(lval* a){
+    
+    size_t len = 0;
+    for(int i = 0; i < a->count; i++){
+        len += strlen(a->cell[i]->str);
+    }
+    
+    /* Concatenate into a new string, the arguments may be shared */
+    lval* x = lval_str("");
+    x->str = realloc(x->str, len + 1);
+    for(int i = 0; i < a->count; i++){
+        strcat(x->str, a->cell[i]->str);
+    }
+
+    return x;
+}
+
+
+lval* builtin_join(lenv* e, lval* a){
+    lval* x = NULL;
+    
+    if(a->cell[0]->type == LVAL_QEXPR){
+        x = ltype_check("join", a, LVAL_QEXPR);
+        if(x->type == LVAL_ERR) { return x; }
+        
+        int n = 0;
+        for(int i = 0; i < a->count; i++){
+            n += a->cell[i]->count;
+        }
+        
+        x = lval_copy(a->cell[0]);
+        if(a->count > 1){
+            lval_reserve(x, n);
+        }
+        
+        for(int i = 1; i < a->count; i++){
+            x = lval_join(x, a->cell[i]);
+        }
+    } else if(a->cell[0]->type == LVAL_STR){
+        x = ltype_check("join", a, LVAL_STR);
+        if(x->type == LVAL_ERR) { return x; }
+        
+        x = lval_join_str(a);
+
+    }
+    
+    return x;
+}
+
+lval* builtin_var(lenv* e, lval* a, char* func){
+    LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
+    
+    lval* syms = a->cell[0];
+    for(int i = 0; i < syms->count; i++){
+        LASSERT(a, (syms->cell[i]->type == LVAL_SYM),
+                "Function '%s' cannot define non-symbole. Got %s, Expected %s.",
+                func, ltype_name(syms->cell[i]->type), ltype_name(LVAL_SYM));
+    }
+    
+    LASSERT(a, (syms->count == a->count-1),
+            "Function '%s' passed too many arguments for symbols. Got %i, Expected %i",
+            func, syms->count, a->count-1);
+    
+    for(int i = 0; i < syms->count; i++){
+        if(strcmp(func, "def") == 0){
+            lenv_def(e, syms->cell[i], a->cell[i+1]);
+        }
+        
+        if(strcmp(func, "=") == 0){
+            /* Frames may be skipped by minor collections */
+            lgc_remember(a->cell[i+1]);
+            lenv_put(e, syms->cell[i], a->cell[i+1]);
+        }
+    }
+    
+    return lval_sexpr();
+}
+
+/* Special form, (def x v) binds the symbol x, other uses evaluate their
+ ** arguments and take a Q-Expression of symbols */
+lval* builtin_def(lenv* e, lval* a){
+    if(a->count == 2 && a->cell[0]->type == LVAL_SYM){
+        lval* v = lval_eval(e, a->cell[1]);
+        if(v->type == LVAL_ERR){
+            return v;
+        }
+        lenv_def(e, a->cell[0], v);
+        return lval_sexpr();
+    }
+    
+    lval* x = lval_eval_args(e, a);
+    if(x->type == LVAL_ERR){
+        return x;
+    }
+    return builtin_var(e, x, "def");
+}
+
+lval* builtin_put(lenv* e, lval* a){
+    return builtin_var(e, a, "=");
+}
+
+lval* builtin_lambda(lenv* e, lval* a){
+    
+    
+    LASSERT_TYPE("\\", a, 0, LVAL_QEXPR);
+    LASSERT_TYPE("\\", a, 1, LVAL_QEXPR);
+    
+    /* Check Q-Expression contains only symbols */
+    for(int i = 0; i < a->cell[0]->count; i++ ){
+        LASSERT(a, (a->cell[0]->cell[i]->type == LVAL_SYM),
+                "Cannot define non-symbol. Got %s, Expected %s",
+                ltype_name(a->cell[0]->cell[i]->type), ltype_name(LVAL_SYM));
+    }
+    
+    /* Pass first two arguments to lval_lambda */
+    return lval_lambda(a->cell[0], a->cell[1]);
+    
+}
+
+/* Special form, (fn (x y) body) with the formals unevaluated and body
+ ** evaluated on each call. A Q-Expression body is run as an S-Expression */
+lval* builtin_fn(lenv* e, lval* a){
+    LASSERT_ARGS("fn", a, 2);
+    
+    lval* f = a->cell[0];
+    LASSERT(a, (f->type == LVAL_SEXPR || f->type == LVAL_QEXPR),
+            "Function '%s' passed incorrect types for argument %i. Got %s, Expected %s",
+            "fn", 0, ltype_name(f->type), ltype_name(LVAL_QEXPR));
+    for(int i = 0; i < f->count; i++){
+        LASSERT(a, (f->cell[i]->type == LVAL_SYM),
+                "Cannot define non-symbol. Got %s, Expected %s",
+                ltype_name(f->cell[i]->type), ltype_name(LVAL_SYM));
+    }
+    
+    lval* formals = lval_copy(f);
+    formals->type = LVAL_QEXPR;
+    
+    lval* body = a->cell[1];
+    if(body->type != LVAL_QEXPR){
+        body = lval_add(lval_qexpr(), body);
+    }
+    return lval_lambda(formals, body);
+}
+
+/* Special form, (let (x 1 y (+ x 1)) body) binds in order in a new frame */
+lval* builtin_let(lenv* e, lval* a){
+    LASSERT_ARGS("let", a, 2);
+    
+    lval* b = a->cell[0];
+    LASSERT(a, (b->type == LVAL_SEXPR || b->type == LVAL_QEXPR),
+            "Function '%s' passed incorrect types for argument %i. Got %s, Expected %s",
+            "let", 0, ltype_name(b->type), ltype_name(LVAL_QEXPR));
+    LASSERT(a, (b->count % 2 == 0),
+            "Function 'let' passed a symbol without a value. Got %i cells", b->count);
+    for(int i = 0; i < b->count; i += 2){
+        LASSERT(a, (b->cell[i]->type == LVAL_SYM),
+                "Cannot define non-symbol. Got %s, Expected %s",
+                ltype_name(b->cell[i]->type), ltype_name(LVAL_SYM));
+    }
+    
+    lenv* frame = lenv_frame(NULL, e);
+    lgc_root_env(frame);
+    
+    lval* x = NULL;
+    for(int i = 0; i < b->count; i += 2){
+        x = lval_eval(frame, b->cell[i+1]);
+        if(x->type == LVAL_ERR){
+            break;
+        }
+        /* Frames may be skipped by minor collections */
+        lgc_remember(x);
+        lenv_put(frame, b->cell[i], x);
+    }
+    
+    if(!x || x->type != LVAL_ERR){
+        x = lval_eval_branch(frame, a->cell[1]);
+    }
+    
+    lgc_unroot_env();
+    lenv_del(frame);
+    return x;
+}
+
+/* Special form, evaluates its arguments in order up to an error */
+lval* builtin_do(lenv* e, lval* a){
+    lval* x = NULL;
+    for(int i = 0; i < a->count; i++){
+        x = lval_eval(e, a->cell[i]);
+        if(x->type == LVAL_ERR){
+            break;
+        }
+    }
+    return x ? x : lval_sexpr();
+}
+
+/* Special form, the first false argument or the last one */
+lval* builtin_and(lenv* e, lval* a){
+    lval* x = NULL;
+    for(int i = 0; i < a->count; i++){
+        x = lval_eval(e, a->cell[i]);
+        if(x->type == LVAL_ERR || !lval_truthy(x)){
+            break;
+        }
+    }
+    return x ? x : lval_num(1);
+}
+
+/* Special form, the first true argument or the last one */
+lval* builtin_or(lenv* e, lval* a){
+    lval* x = NULL;
+    for(int i = 0; i < a->count; i++){
+        x = lval_eval(e, a->cell[i]);
+        if(x->type == LVAL_ERR || lval_truthy(x)){
+            break;
+        }
+    }
+    return x ? x : lval_num(0);
+}
+
+/* Code for a part of a loop evaluated on every iteration in e, NULL
+ ** when the part is evaluated directly. Q-Expressions run as S-Expressions.
+ ** The code stays rooted until lval_loop_done */
+static lcode* lval_loop_code(lenv* e, lval* v){
+#ifdef BLISP_NO_VM
+    return NULL;
+#else
+    if(v->type == LVAL_SEXPR || v->type == LVAL_QEXPR){
+        lcode* c = lvm_compile(e, v, NULL);
+        lgc_root(c->pool);
+        return c;
+    }
+    return NULL;
+#endif
+}
+
+static void lval_loop_done(lcode* c){
+    if(c){
+        lgc_unroot(1);
+        lcode_del(c);
+    }
+}
+
+static lval* lval_loop_run(lenv* e, lval* v, lcode* c){
+    return c ? lvm_run(e, c) : lval_eval_branch(e, v);
+}
+
+/* Special form, (while cond body) runs body while cond is true */
+lval* builtin_while(lenv* e, lval* a){
+    LASSERT_ARGS("while", a, 2);
+    
+    lcode* cond = lval_loop_code(e, a->cell[0]);
+    lcode* body = lval_loop_code(e, a->cell[1]);
+    
+    lval* x = NULL;
+    for(;;){
+        x = lval_loop_run(e, a->cell[0], cond);
+        if(x->type == LVAL_ERR || !lval_truthy(x)){
+            break;
+        }
+        x = lval_loop_run(e, a->cell[1], body);
+        if(x->type == LVAL_ERR){
+            break;
+        }
+    }
+    
+    lval_loop_done(body);
+    lval_loop_done(cond);
+    return x->type == LVAL_ERR ? x : lval_sexpr();
+}
+
+/* Binding (x v) of dotimes and for-each, or an error */
+static lval* lval_loop_var(char* func, lval* a){
+    LASSERT_ARGS(func, a, 2);
+    
+    lval* b = a->cell[0];
+    LASSERT(a, ((b->type == LVAL_SEXPR || b->type == LVAL_QEXPR) && b->count == 2),
+            "Function '%s' needs a symbol and a value to loop over. Got %s",
+            func, ltype_name(b->type));
+    LASSERT(a, (b->cell[0]->type == LVAL_SYM),
+            "Cannot define non-symbol. Got %s, Expected %s",
+            ltype_name(b->cell[0]->type), ltype_name(LVAL_SYM));
+    return NULL;
+}
+
+/* Run body of a dotimes or for-each in frame with k bound to each of the
+ ** n values, taken from cells or chars, or 0 to n-1 */
+static lval* lval_loop(lenv* frame, lval* k, lval* body, lval** cells, char* chars, int64_t n){
+    lcode* c = lval_loop_code(frame, body);
+    
+    lval* x = NULL;
+    for(int64_t i = 0; i < n; i++){
+        lval* v;
+        if(cells){
+            v = cells[i];
+        } else if(chars){
+            char s[2] = { chars[i], '\0' };
+            v = lval_str(s);
+        } else {
+            v = lval_num(i);
+        }
+        
+        /* Rebinding makes the next minor collection rescan the frame */
+        lenv_put(frame, k, v);
+        lgc_unroot_env();
+        lgc_root_env(frame);
+        
+        x = lval_loop_run(frame, body, c);
+        if(x->type == LVAL_ERR){
+            break;
+        }
+    }
+    
+    lval_loop_done(c);
+    return x && x->type == LVAL_ERR ? x : lval_sexpr();
+}
+
+/* Special form, (dotimes (i n) body) runs body for i from 0 to n-1 */
+lval* builtin_dotimes(lenv* e, lval* a){
+    lval* err = lval_loop_var("dotimes", a);
+    if(err){
+        return err;
+    }
+    
+    lval* n = lval_eval(e, a->cell[0]->cell[1]);
+    if(n->type == LVAL_ERR){
+        return n;
+    }
+    LASSERT(a, (n->type == LVAL_NUM),
+            "Function '%s' passed incorrect types for argument %i. Got %s, Expected %s",
+            "dotimes", 0, ltype_name(n->type), ltype_name(LVAL_NUM));
+    
+    lenv* frame = lenv_frame(NULL, e);
+    lgc_root_env(frame);
+    lval* x = lval_loop(frame, a->cell[0]->cell[0], a->cell[1], NULL, NULL, n->num);
+    lgc_unroot_env();
+    lenv_del(frame);
+    return x;
+}
+
+/* Special form, (for-each (x xs) body) runs body for each cell of a
+ ** Q-Expression or each character of a string */
+lval* builtin_for_each(lenv* e, lval* a){
+    lval* err = lval_loop_var("for-each", a);
+    if(err){
+        return err;
+    }
+    
+    lval* xs = lval_eval(e, a->cell[0]->cell[1]);
+    if(xs->type == LVAL_ERR){
+        return xs;
+    }
+    LASSERT(a, (xs->type == LVAL_QEXPR || xs->type == LVAL_STR),
+            "Function '%s' passed incorrect types for argument %i. Got %s, Expected %s",
+            "for-each", 0, ltype_name(xs->type), ltype_name(LVAL_QEXPR));
+    
+    lenv* frame = lenv_frame(NULL, e);
+    lgc_root(xs);
+    lgc_root_env(frame);
+    lval* x = xs->type == LVAL_STR
+        ? lval_loop(frame, a->cell[0]->cell[0], a->cell[1], NULL, xs->str, strlen(xs->str))
+        : lval_loop(frame, a->cell[0]->cell[0], a->cell[1], xs->cell, NULL, xs->count);
+    lgc_unroot_env();
+    lgc_unroot(1);
+    lenv_del(frame);
+    return x;
+}
+
+/* Free the mpc tree t like mpc_ast_delete does, but without recursing */
+void lval_read_del(mpc_ast_t* t){
+    mpc_ast_t** todo = NULL;
+    int n = 0, cap = 0;
+    LVEC_PUSH(todo, n, cap, t);
+    
+    while(n > 0){
+        mpc_ast_t* a = todo[--n];
+        for(int i = 0; i < a->children_num; i++){
+            LVEC_PUSH(todo, n, cap, a->children[i]);
+        }
+        free(a->children);
+        free(a->tag);
+        free(a->contents);
+        free(a);
+    }
+    free(todo);
+}
+
+/* Contents of f as a string, NULL if reading failed */
+static char* lval_read_file(FILE* f){
+    char* s = NULL;
+    size_t n = 0, cap = 0;
+    while(1){
+        if(cap - n < 4096){
+            cap = cap ? cap * 2 : 65536;
+            s = realloc(s, cap);
+        }
+        size_t got = fread(s + n, 1, cap - n - 1, f);
+        if(got == 0){
+            break;
+        }
+        n += got;
+    }
+    
+    if(ferror(f)){
+        free(s);
+        return NULL;
+    }
+    s[n] = '\0';
+    return s;
+}
+
+lval* builtin_load(lenv* e, lval* a){
+    LASSERT_ARGS("load", a, 1);
+    LASSERT_TYPE("load", a, 0, LVAL_STR);
+    
+    /* Read FIle given */
+    FILE* f = fopen(a->cell[0]->str, "rb");
+    LASSERT(a, f, "Could not load File %s: error: Unable to open file!", a->cell[0]->str);
+    char* input = lval_read_file(f);
+    fclose(f);
+    LASSERT(a, input, "Could not load File %s: error: Unable to read file!", a->cell[0]->str);
+    
+    /* Refuse nesting too deep to evaluate before building its tree */
+    lval* deep = lval_read_depth(input);
+    if(deep){
+        free(input);
+        return deep;
+    }
+    
+    /* Parse it */
+    mpc_result_t r;
+    int parsed = mpc_parse(a->cell[0]->str, input, Blisp, &r);
+    free(input);
+    if(parsed) {
+        
+        /* Read Contents*/
         lval* expr = lval_read(r.output);
-        mpc_ast_delete(r.output);
+        lval_read_del(r.output);
         
         /* Evaluate each expression */
-        while(expr->count){
-            lval* x = lval_eval(e, lval_pop(expr, 0));
+        lgc_root(expr);
+        for(int i = 0; i < expr->count; i++){
+            lval* x = lval_exec(e, expr->cell[i]);
+            
+            /* if error print it */
+            if(x->type == LVAL_ERR) {
+                lval_println(x);
+            }
+        }
+        lgc_unroot(1);
+        
+        /* Return empty list */
+        return lval_sexpr();
+    } else {
+        
+        /* Get Parse error as String */
+        char* err_msg = mpc_err_string(r.error);
+        mpc_err_delete(r.error);
+        
+        /* Create new error msg */
+        lval* err = lval_err("Could not load File %s", err_msg);
+        free(err_msg);
+        
+        return err;
+    }
+    
+}
+
+lval* builtin_print(lenv* e, lval* a){
+    
+    /* Print each argument followed by space */
+    for(int i = 0; i < a->count; i++){
+        lval_print(a->cell[i]);
+        putchar(' ');
+    }
+    
+    /* Print new line */
+    putchar('\n');
+    
+    return lval_sexpr();
+}
+
+lval* builtin_mem(lenv* e, lval* a){
+    
+    /* Sum up the cell size classes */
+    long hits = 0, misses = 0;
+    for(int i = 0; i < LSLAB_CELL_CLASSES; i++){
+        hits += Alloc->cells[i].hits;
+        misses += Alloc->cells[i].misses;
+    }
+    
+    printf("lvals: %ld hits, %ld misses\n", Alloc->lvals.hits, Alloc->lvals.misses);
+    printf("cells: %ld hits, %ld misses\n", hits, misses);
+    printf("envs: %ld hits, %ld misses\n", Alloc->envs.hits, Alloc->envs.misses);
+    printf("gc: %ld minor, %ld major, %d young, %d old, %.3fs\n",
+           Heap->minors, Heap->majors, Heap->nyoung, Heap->nold, Heap->seconds);
+    printf("pauses: max %ldus, p99 %ldus, budget %ldus, nursery %d\n",
+           Heap->max_pause, lgc_pause_pct(99), Heap->budget, Heap->nursery);
+    
+    return lval_sexpr();
+}
+
+lval* builtin_gc_budget(lenv* e, lval* a){
+    LASSERT_ARGS("gc-budget", a, 1);
+    LASSERT_TYPE("gc-budget", a, 0, LVAL_NUM);
+    LASSERT(a, (a->cell[0]->num > 0),
+            "Function 'gc-budget' passed a budget of %li microseconds", (long)a->cell[0]->num);
+    
+    Heap->budget = (long)a->cell[0]->num;
+    return lval_sexpr();
+}
+
+lval* builtin_max_depth(lenv* e, lval* a){
+    LASSERT_ARGS("max-depth", a, 1);
+    LASSERT_TYPE("max-depth", a, 0, LVAL_NUM);
+    LASSERT(a, (a->cell[0]->num > 0 && a->cell[0]->num <= INT_MAX),
+            "Function 'max-depth' passed a depth of %li", (long)a->cell[0]->num);
+    
+    Heap->max_depth = (int)a->cell[0]->num;
+    return lval_sexpr();
+}
+
+lval* builtin_error(lenv* e, lval* a){
+    LASSERT_ARGS("error", a, 1);
+    LASSERT_TYPE("error", a, 0, LVAL_STR);
+    
+    /* Build error object */
+    return lval_err(a->cell[0]->str);
+}
+
+/* Append the elements of y to the new list x, y itself is left alone */
+lval* lval_join(lval* x, lval* y){
+    
+    lval_reserve(x, x->count + y->count);
+    for(int i = 0; i < y->count; i++){
+        x = lval_add(x, y->cell[i]);
+    }
+    
+    return x;
+}
+
+/* Compare x and y, lists and lambdas only by their length */
+static int lval_eq_shallow(lval* x, lval* y){
+    
+    if(x->type != y->type){
+        return 0;
+    }
+    
+    switch(x->type){
+        case LVAL_NUM:
+            return (x->num == y->num);
+        case LVAL_DBL:
+            return (x->dbl == y->dbl);
+        case LVAL_BIG:
+            return lbig_cmp(x->big, y->big) == 0;
+        case LVAL_MAT:
+            if(x->rows != y->rows){
+                return 0;
+            }
+            /* Fall through to the numbers */
+        case LVAL_VEC:
+            if(x->count != y->count){
+                return 0;
+            }
+            for(int i = 0; i < x->count; i++){
+                if(x->vec[i] != y->vec[i]){
+                    return 0;
+                }
+            }
+            return 1;
+            
+        case LVAL_ERR:
+            return (strcmp(x->err, y->err) == 0);
+        case LVAL_SYM:
+            return (x->sym == y->sym);
+            
+        case LVAL_FORM:
+            return x->builtin == y->builtin;
+            
+        case LVAL_FUN:
+            return x->builtin == y->builtin;
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+            return x->count == y->count;
+        case LVAL_STR:
+            return (strcmp(x->str,y->str) == 0);
+    }
+    
+    return 0;
+}
+
+/* Pairs of cells still to compare are kept on a heap allocated stack,
+ ** so deeply nested lists compare without recursing */
+int lval_eq(lval* x, lval* y){
+    lval** todo = NULL;
+    int n = 0;
+    int cap = 0;
+    
+    int eq;
+    while((eq = lval_eq_shallow(x, y))){
+        if(x->type == LVAL_FUN && !x->builtin){
+            LVEC_PUSH(todo, n, cap, x->lambda->body);
+            LVEC_PUSH(todo, n, cap, y->lambda->body);
+            LVEC_PUSH(todo, n, cap, x->lambda->formals);
+            LVEC_PUSH(todo, n, cap, y->lambda->formals);
+        } else if(x->type == LVAL_SEXPR || x->type == LVAL_QEXPR){
+            /* First cells on top */
+            for(int i = x->count - 1; i >= 0; i--){
+                LVEC_PUSH(todo, n, cap, x->cell[i]);
+                LVEC_PUSH(todo, n, cap, y->cell[i]);
+            }
+        }
+        
+        if(n == 0){
+            break;
+        }
+        y = todo[--n];
+        x = todo[--n];
+    }
+    
+    free(todo);
+    return eq;
+}
+
+/* Bind the arguments a to the formals of a lambda in frame. Returns an
+ ** error, or NULL with *bound set to the number of formals consumed */
+static lval* lval_bind(lenv* frame, lval* formals, lval* a, int* bound){
+    int given = a->count;
+    int total = formals->count;
+    
+    /* Loop while remain argument to process */
+    int i = 0;
+    for(int j = 0; j < a->count; j++){
+        
+        if(i == formals->count){
+            return lval_err("Function passed too many arguments. Got %i, Expected %i",
+                            given, total);
+        }
+        
+        /* Next symbole from formals */
+        lval* sym = formals->cell[i++];
+        
+        if(sym->sym == Syms->rest){
+            /* Ensure '&' followed by symbol */
+            if(i != formals->count - 1){
+                return lval_err("Function format invalid. Symbole '&' not followed by single symbole.");
+            }
             
-            /* if error print it */
-            if(x->type == LVAL_ERR) {
-                lval_println(x);
+            /* Next formal should be bound to remainig arguments */
+            lval* rest = lval_qexpr();
+            for(; j < a->count; j++){
+                lval_add(rest, a->cell[j]);
             }
-            lval_del(x);
+            lenv_put(frame, formals->cell[i++], rest);
+            break;
         }
         
-        /* Delete expression and arguments */
-        lval_del(expr);
-        lval_del(a);
+        /* Push var to function stack */
+        lenv_put(frame, sym, a->cell[j]);
+    }
+    
+    /* if '&' remains in formal list it should be bound to empty list */
+    if(i < formals->count
+       && formals->cell[i]->sym == Syms->rest){
         
-        /* Return empty list */
-        return lval_sexpr();
-    } else {
+        /* Check '&' is not passed invalidily */
+        if(i != formals->count - 2){
+            return lval_err("Function format invalid. Symbol '&' not followed by signle symbol!");
+        }
         
-        /* Get Parse error as String */
-        char* err_msg = mpc_err_string(r.error);
-        mpc_err_delete(r.error);
+        /* Bind next symbol to an empty list */
+        lenv_put(frame, formals->cell[i+1], lval_qexpr());
+        i += 2;
+    }
+    
+    *bound = i;
+    return NULL;
+}
+
+/* Whether given arguments bind every formal of l without an error */
+int lval_saturates(llambda* l, int given){
+    if(l->arity < 0){
+        return 0;
+    }
+    return given == l->arity || (l->variadic && given > l->arity);
+}
+
+/* Whether code nested depth deep may not go deeper, past Heap->max_depth
+ ** or running low on C stack */
+static int lval_too_deep(int depth){
+    char here;
+    uintptr_t at = (uintptr_t)&here;
+    uintptr_t used = at < Heap->stack ? Heap->stack - at : at - Heap->stack;
+    return depth >= Heap->max_depth || used > (uintptr_t)Heap->stack_max;
+}
+
+static lval* lval_depth_err(void){
+    if(Heap->depth >= Heap->max_depth){
+        return lval_err("Maximum evaluation depth of %i exceeded", Heap->max_depth);
+    }
+    return lval_err("Evaluation nested too deep for the C stack");
+}
+
+lval* lval_call(lenv* e, lval* f, lval* a){
+    
+    /* if builtin, apply */
+    if(f->builtin){
+        return f->builtin(e, a);
+    }
+    
+    if(lval_too_deep(Heap->depth)){
+        return lval_depth_err();
+    }
+    
+    /* Functions are shared, bind into a fresh frame holding
+     ** the arguments of earlier partial applications */
+    llambda* l = f->lambda;
+    lenv* frame = lenv_frame(l->env, e);
+    
+    int i = 0;
+    if(lval_saturates(l, a->count)){
+        /* Formals are distinct and new to the frame, move the arguments
+         ** into fresh slots. The rest list shares the argument cells */
+        for(; i < l->arity; i++){
+            lenv_push(frame, l->formals->cell[i]->sym, a->cell[i]);
+        }
+        if(l->variadic){
+            lval* rest = lval_copy(a);
+            rest->type = LVAL_QEXPR;
+            rest->cell += l->arity;
+            rest->count -= l->arity;
+            lenv_push(frame, l->formals->cell[i+1]->sym, rest);
+            i += 2;
+        }
+    } else {
+        lval* err = lval_bind(frame, l->formals, a, &i);
+        if(err){
+            lenv_del(frame);
+            return err;
+        }
+    }
+    
+    /* All formals have been bound */
+    if(i == f->lambda->formals->count){
+        lgc_root_env(frame);
+        Heap->depth++;
+#ifdef BLISP_NO_VM
+        lval* x = lval_eval_sexpr(frame, f->lambda->body);
+#else
+        /* Trampoline, a tail call leaves its function and arguments on
+         ** the root stack and returns NULL. The callee runs in the same
+         ** frame: it would see the caller's bindings through its parent
+         ** anyway, so only its own bindings are put over them */
+        int held = 0;
+        lval* x = NULL;
+        while(1){
+            if(!f->lambda->code){
+                f->lambda->code = lvm_compile(frame, f->lambda->body, f->lambda);
+                lgc_remember(f->lambda->code->pool);
+            }
+            x = lvm_run(frame, f->lambda->code);
+            if(x){
+                break;
+            }
+            
+            a = Heap->roots[Heap->nroots - 1];
+            f = Heap->roots[Heap->nroots - 2];
+            
+            lenv* env = f->lambda->env;
+            for(int j = 0; j < env->cap; j++){
+                if(env->syms[j]){
+                    lval k = { .type = LVAL_SYM, .sym = env->syms[j] };
+                    lenv_put(frame, &k, env->vals[j]);
+                }
+            }
+            lval_bind(frame, f->lambda->formals, a, &i);
+            
+            /* Keep only the running function rooted, and have the next
+             ** minor collection rescan the rebound frame */
+            lgc_unroot(2 + held);
+            lgc_root(f);
+            held = 1;
+            lgc_unroot_env();
+            lgc_root_env(frame);
+        }
+        lgc_unroot(held);
+#endif
+        Heap->depth--;
+        lgc_unroot_env();
         
-        /* Create new error msg */
-        lval* err = lval_err("Could not load File %s", err_msg);
-        free(err_msg);
-        lval_del(a);
+        lenv_del(frame);
+        return x;
+    } else {
+        /* Return partialy evaluted function owning the frame */
+        lval* rest = lval_qexpr();
+        for(; i < f->lambda->formals->count; i++){
+            lval_add(rest, f->lambda->formals->cell[i]);
+        }
         
-        return err;
+        lval* x = lval_lambda(rest, f->lambda->body);
+        lenv_del(x->lambda->env);
+        lenv_detach(frame);
+        x->lambda->env = frame;
+        llambda_shape(x->lambda);
+        return x;
     }
-    
 }
 
-lval* builtin_print(lenv* e, lval* a){
+/* Powers of ten exactly representable as doubles */
+static const double lnum_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+    1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+    1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+lval* lval_read_num(mpc_ast_t* t){
+    /* Tokens match -?[0-9]+([.][0-9]+)? so no validation is needed */
+    const char* s = t->contents;
+    int neg = *s == '-';
+    s += neg;
+    
+    /* Gather up to 19 significant digits, the rest only get counted */
+    uint64_t w = 0;
+    int digits = 0, frac = 0, zeros = 0, dot = 0;
+    for(; *s; s++){
+        if(*s == '.'){
+            dot = 1;
+            continue;
+        }
+        int d = *s - '0';
+        frac += dot;
+        if(d == 0 && dot){
+            /* Trailing fraction zeros don't change the value */
+            zeros++;
+            continue;
+        }
+        for(; zeros > 0; zeros--){
+            if(digits > 0) digits++;
+            if(digits <= 19) w *= 10;
+        }
+        if(digits > 0 || d != 0) digits++;
+        if(digits <= 19) w = w * 10 + d;
+    }
+    frac -= zeros;
     
-    /* Print each argument followed by space */
-    for(int i = 0; i < a->count; i++){
-        lval_print(a->cell[i]);
-        putchar(' ');
+    if(!dot){
+        if(digits <= 19 && w <= (uint64_t)INT64_MAX + neg){
+            return lval_num(neg ? (int64_t)(0 - w) : (int64_t)w);
+        }
+        
+        /* Too large for an integer, read it as a bignum */
+        return lval_big(lbig_read(t->contents));
     }
     
-    /* Print new line */
-    putchar('\n');
-    lval_del(a);
+    /* Both operands are exact so the quotient is correctly rounded */
+    if(digits <= 19 && w <= (1ULL << 53) && frac <= 22){
+        double x = (double)w / lnum_pow10[frac];
+        return lval_dbl(neg ? -x : x);
+    }
     
-    return lval_sexpr();
+    /* Long mantissa, let the C library round it */
+    errno = 0;
+    double x = strtod(t->contents, NULL);
+    return errno != ERANGE ? lval_dbl(x) : lval_err("invalid number");
 }
 
-lval* builtin_error(lenv* e, lval* a){
-    LASSERT_ARGS("error", a, 1);
-    LASSERT_TYPE("error", a, 0, LVAL_STR);
+lval* lval_read_str(mpc_ast_t* t){
     
-    /* Build error object */
-    lval* err = lval_err(a->cell[0]->str);
+    /* Replace final quet with terminating char*/
+    t->contents[strlen(t->contents)-1] = '\0';
+    
+    /* Copy string without the leading quote */
+    char* unescaped = malloc(strlen(t->contents+1)+1);
+    strcpy(unescaped, t->contents+1);
+    
+    /* Pass thru unescape function*/
+    unescaped = mpcf_unescape(unescaped);
+    
+    lval* v = lval_str(unescaped);
     
-    /* Delete argument */
-    lval_del(a);
+    free(unescaped);
+    
+    return v;
     
-    return err;
 }
 
-lval* lval_join(lval* x, lval* y){
+/* Error when the brackets of s nest deeper than Heap->max_depth, NULL
+ ** otherwise. Checked before parsing, the evaluator would refuse such
+ ** code anyway and reading it only costs memory */
+lval* lval_read_depth(char* s){
+    int depth = 0;
+    for(; *s; s++){
+        switch(*s){
+            case '"':
+                /* Brackets in strings don't nest */
+                for(s++; *s && *s != '"'; s++){
+                    if(*s == '\\' && s[1]){
+                        s++;
+                    }
+                }
+                if(!*s){
+                    return NULL;
+                }
+                break;
+            case ';':
+                while(s[1] && s[1] != '\n' && s[1] != '\r'){
+                    s++;
+                }
+                break;
+            case '(':
+            case '{':
+                if(++depth > Heap->max_depth){
+                    return lval_err("Input nested deeper than the maximum depth of %i", Heap->max_depth);
+                }
+                break;
+            case ')':
+            case '}':
+                depth--;
+                break;
+        }
+    }
+    return NULL;
+}
+
+/* Value of a leaf of the mpc tree, NULL for a list */
+static lval* lval_read_atom(mpc_ast_t* t){
+    if(strstr(t->tag, "number")){
+        return lval_read_num(t);
+    }
+    
+    if(strstr(t->tag, "symbol")){
+        return lval_sym(t->contents);
+    }
     
-    while(y->count){
-        x = lval_add(x, lval_pop(y, 0));
+    if(strstr(t->tag, "string")) {
+        return lval_read_str(t);
     }
     
-    lval_del(y);
-    return x;
+    return NULL;
 }
 
-int lval_eq(lval* x, lval* y){
+/* Empty list for t with room for its children, which include the brackets */
+static lval* lval_read_list(mpc_ast_t* t){
+    lval* x = NULL;
     
-    if(x->type != y->type){
-        return 0;
+    if(strstr(t->tag,"qexpr")){
+        x = lval_qexpr();
     }
     
-    switch(x->type){
-        case LVAL_NUM:
-            return (x->num == y->num);
-            
-        case LVAL_ERR:
-            return (strcmp(x->err, y->err) == 0);
-        case LVAL_SYM:
-            return (strcmp(x->sym, y->sym) == 0);
-            
-        case LVAL_FUN:
-            if(x->builtin || y->builtin){
-                return x->builtin == y->builtin;
-            } else {
-                return lval_eq(x->formals, y->formals) && lval_eq(x->body, y->body);
-            }
-        case LVAL_QEXPR:
-        case LVAL_SEXPR:
-            if(x->count != y->count) {
-                return 0;
-            }
-            
-            /* Check that all elements are equal*/
-            for(int i = 0; i < x->count; i++){
-                /* If one is not equal than expression is false */
-                if(!lval_eq(x->cell[i], y->cell[i])){
-                    return 0;
-                }
-            }
-            
-            /* Otherwise return true */
-            return 1;
-        case LVAL_STR:
-            return (strcmp(x->str,y->str) == 0);
+    if(strcmp(t->tag, ">") == 0 || strstr(t->tag, "sexpr")){
+        x = lval_sexpr();
     }
     
-    return 0;
+    lval_reserve(x, t->children_num);
+    return x;
 }
 
-lval* lval_call(lenv* e, lval* f, lval* a){
+/* Whether a child of a list is syntax rather than a cell */
+static int lval_read_skip(mpc_ast_t* t){
+    return strstr(t->tag, "comment")
+        || strcmp(t->contents, "(") == 0
+        || strcmp(t->contents, ")") == 0
+        || strcmp(t->contents, "{") == 0
+        || strcmp(t->contents, "}") == 0
+        || strcmp(t->tag,  "regex") == 0;
+}
+
+/* A list lval_read is filling, from the children of t starting at i */
+typedef struct lreading {
+    mpc_ast_t* t;
+    lval* x;
+    int i;
+} lreading;
+
+/* Walks thru the mst tree and creates a S-Expr tree. Lists being filled
+ ** are kept on a heap allocated stack, so deeply nested input does not
+ ** recurse */
+lval* lval_read(mpc_ast_t* t){
     
-    /* if builtin, apply */
-    if(f->builtin){
-        return f->builtin(e, a);
+    // TODO: Add verbose
+    
+    lval* x = lval_read_atom(t);
+    if(x){
+        return x;
     }
     
-    /* Argument count */
-    int given = a->count;
-    int total = f->formals->count;
+    lreading* todo = NULL;
+    int n = 0, cap = 0;
+    LVEC_PUSH(todo, n, cap, ((lreading){ t, lval_read_list(t), 0 }));
     
-    /* Loop while remain argument to process */
-    while(a->count){
+    while(1){
+        lreading* r = &todo[n - 1];
         
-        if(f->formals->count == 0){
-            lval_del(a);
-            return lval_err("Function passed too many arguments. Got %i, Expected %i",
-                            given, total);
+        /* Finished list goes into its parent */
+        if(r->i == r->t->children_num){
+            x = r->x;
+            if(--n == 0){
+                break;
+            }
+            todo[n - 1].x = lval_add(todo[n - 1].x, x);
+            continue;
         }
         
-        /* Pop symbole from formals */
-        lval* sym = lval_pop(f->formals, 0);
+        mpc_ast_t* c = r->t->children[r->i++];
+        if(lval_read_skip(c)){
+            continue;
+        }
         
-        if(strcmp(sym->sym, "&") == 0){
-            /* Ensure '&' followed by symbol */
-            if(f->formals->count != 1){
-                lval_del(a);
-                return lval_err("Function format invalid. Symbole '&' not followed by single symbole.");
+        lval* v = lval_read_atom(c);
+        if(v){
+            r->x = lval_add(r->x, v);
+        } else {
+            LVEC_PUSH(todo, n, cap, ((lreading){ c, lval_read_list(c), 0 }));
+        }
+    }
+    
+    free(todo);
+    return x;
+    
+}
+
+lval* lval_eval(lenv* e, lval* v){
+    
+    // TODO: Add verbose
+    
+    // Safe point, everything live is reachable from the roots
+    if(Heap->nyoung >= Heap->next_gc){
+        lgc_collect();
+    }
+    
+    if(v->type == LVAL_SYM){
+        return lenv_get(e, v);
+    }
+    
+    // Evaluate S-expression
+    if( v->type == LVAL_SEXPR) {
+        return lval_eval_sexpr(e, v);
+    }
+    
+    return v;
+}
+
+
+/* Evaluate the cells of v as an S-expression, v is left untouched */
+lval* lval_eval_sexpr(lenv* e, lval* v){
+    
+    if(lval_too_deep(Heap->depth)){
+        return lval_depth_err();
+    }
+    Heap->depth++;
+    
+    lval* x;
+    if(v->count < 2){
+        lval* a = lval_sexpr();
+        lgc_root(v);
+        lgc_root(a);
+        for(int i = 0; i < v->count; i++){
+            lval_add(a, lval_eval(e, v->cell[i]));
+        }
+        lgc_unroot(2);
+        x = lval_apply(e, a);
+    } else {
+        // The head decides whether the rest is evaluated
+        lgc_root(v);
+        lval* f = lval_eval(e, v->cell[0]);
+        lgc_root(f);
+        x = lval_eval_head(e, v, f);
+        lgc_unroot(2);
+    }
+    
+    Heap->depth--;
+    return x;
+}
+
+/* Evaluate v, of two cells or more, whose first cell evaluated to f.
+ ** Special forms get the other cells unevaluated */
+lval* lval_eval_head(lenv* e, lval* v, lval* f){
+    
+    if(f->type == LVAL_FORM){
+        lval* a = lval_copy(v);
+        lval_pop(a, 0);
+        lgc_root(a);
+        lval* x = f->builtin(e, a);
+        lgc_unroot(1);
+        return x;
+    }
+    
+    // Evaluate children into a new argument list
+    lval* a = lval_sexpr();
+    lval_reserve(a, v->count);
+    lval_add(a, f);
+    lgc_root(v);
+    lgc_root(a);
+    for(int i = 1; i < v->count; i++){
+        lval_add(a, lval_eval(e, v->cell[i]));
+    }
+    lgc_unroot(2);
+    
+    return lval_apply(e, a);
+}
+
+/* Apply an evaluated S-expression a */
+lval* lval_apply(lenv* e, lval* a){
+    
+    // Check for Errors
+    for(int i = 0; i < a->count; i++){
+        if( a->cell[i]->type == LVAL_ERR) {
+            return a->cell[i];
+        }
+    }
+    
+    // Empty expression
+    if( a->count == 0){
+        return a;
+    }
+    
+    // Single expression
+    if( a->count == 1){
+        return a->cell[0];
+    }
+    
+    // Ensure first elemnt is a function
+    lval* f = lval_pop(a, 0);
+    if(f->type != LVAL_FUN){
+        return lval_err("S-Expression starts with incorrect type. Got %s, Expexted %s",
+                        ltype_name(f->type),ltype_name(LVAL_FUN));
+    }
+    
+    // Call to function, builtins own a and borrow its cells
+    lgc_root(f);
+    lgc_root(a);
+    lval* result = lval_call(e, f, a);
+    lgc_unroot(2);
+    return result;
+}
+
+
+/*
+ ** Bytecode
+ **
+ ** S-expressions compile to a small stack code run by lvm_run. The
+ ** operand stack is the collector's root stack, so everything the VM
+ ** holds is reachable at its safe points.
+ **
+ ** Scoping stays dynamic. A lambda's own formals and closure bindings are
+ ** always in the frame its body runs in, so they are loaded from that
+ ** frame alone, at a slot cached in the instruction. Other symbols are
+ ** looked up from the top level enviorment while no running frame binds
+ ** them, and through the whole chain otherwise. Each such lookup keeps
+ ** the value it found in an inline cache, valid until a top level binding
+ ** changes, and the slot it was at for lookups after that.
+ **
+ ** The special forms `if`, `do`, `and`, `or` and `def` of a symbol, and
+ ** the arithmetic and comparison builtins get their own instructions,
+ ** guarded by a check that the symbol still names them. Anything else
+ ** takes the generic call path, after checking the head is no special
+ ** form. Loops compile their parts on entry. Heads naming another special
+ ** form than expected, and code nested deeper than the depth limit,
+ ** evaluate the expression with the tree walker.
+ ** Build with -DBLISP_NO_VM to evaluate with the tree walker only, e.g. to
+ ** compare the two.
+ */
+enum { LOP_CONST, LOP_LOCAL, LOP_GLOBAL, LOP_HEAD, LOP_APPLY, LOP_TAIL, LOP_PRIM,
+       LOP_BRANCH, LOP_SEQ, LOP_AND, LOP_OR, LOP_DEF, LOP_GUARD, LOP_JUMP, LOP_EVAL,
+       LOP_RETURN };
+
+enum { LFORM_IF, LFORM_DO, LFORM_AND, LFORM_OR, LFORM_DEF, LFORM_COUNT };
+
+static char* lvm_form_names[LFORM_COUNT] = { "if", "do", "and", "or", "def" };
+
+static lbuiltin lvm_form_funs[LFORM_COUNT] = {
+    builtin_if, builtin_do, builtin_and, builtin_or, builtin_def
+};
+
+static lbuiltin lvm_prim_funs[LPRIM_COUNT] = {
+    builtin_add, builtin_sub, builtin_mul, builtin_div,
+    builtin_lt, builtin_gt, builtin_lte, builtin_gte, builtin_eq, builtin_ne
+};
+
+static void lvm_emit(lcode* c, int op){
+    LVEC_PUSH(c->ops, c->nops, c->ops_cap, op);
+}
+
+static int lvm_const(lcode* c, lval* v){
+    LVEC_PUSH(c->consts, c->nconsts, c->consts_cap, v);
+    return c->nconsts - 1;
+}
+
+static int lvm_form_index(lval* v){
+    if(v->type == LVAL_SYM){
+        for(int f = 0; f < LFORM_COUNT; f++){
+            if(strcmp(v->sym->name, lvm_form_names[f]) == 0){
+                return f;
             }
-            
-            /* Next formal should be bound to remainig arguments */
-            lval* nsym = lval_pop(f->formals, 0);
-            lenv_put(f->env, nsym, builtin_list(e, a));
-            lval_del(sym);
-            lval_del(nsym);
         }
-        /* Pop argement */
-        lval* val = lval_pop(a, 0);
-        
-        /* Push var to function stack */
-        lenv_put(f->env, sym, val);
-        
-        /* Delete symbole and value */
-        lval_del(sym);
-        lval_del(val);
-        
-        
-        
     }
-    
-    /* Argument list was pushed to stack, can be cleaned */
-    lval_del(a);
-    
-    /* if '&' remains in formal list it should be bound to empty list */
-    if(f->formals->count > 0
-       && strcmp(f->formals->cell[0]->sym,"&") == 0){
-        
-        /* Check '&' is not passed invalidily */
-        if(f->formals->count != 2){
-            return lval_err("Function format invalid. Symbol '&' not followed by signle symbol!");
+    return -1;
+}
+
+static int lvm_prim_index(lval* v){
+    if(v->type == LVAL_SYM){
+        for(int p = 0; p < LPRIM_COUNT; p++){
+            if(strcmp(v->sym->name, lprim_names[p]) == 0){
+                return p;
+            }
         }
-        
-        /* Pop and delete '&' symbol */
-        lval_del(lval_pop(f->formals, 0));
-        
-        /* Pop next symbol and create empty list */
-        lval* sym = lval_pop(f->formals, 0);
-        lval* val = lval_qexpr();
-        
-        /* Bind to enviorment and delete */
-        lenv_put(f->env, sym, val);
-        lval_del(sym);
-        lval_del(val);
-        
     }
-    
-    /* All formals have been bound */
-    if(f->formals->count == 0){
-        f->env->par = e;
-        return builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
-    } else {
-        /* Return partialy evaluted function */
-        return lval_copy(f);
+    return -1;
+}
+
+/* Whether k is bound in every frame running the body of fn */
+static int lvm_local(llambda* fn, lsym* k){
+    if(!fn){
+        return 0;
     }
     
+    for(int i = 0; i < fn->formals->count; i++){
+        if(fn->formals->cell[i]->sym == k && k != Syms->rest){
+            return 1;
+        }
+    }
     
+    int hint = 0;
+    return lenv_find(fn->env, k, &hint) != NULL;
 }
 
-lval* lval_read_num(mpc_ast_t* t){
-    errno = 0;
-    lval* v = NULL;
-    double x = strtod(t->contents, NULL);
+static lval* lvm_prim(int p, lval** args, int n);
+
+/* Most operands of a folded application, and deepest nesting folded */
+#define LFOLD_ARGS 16
+#define LFOLD_DEPTH 64
+
+static int lfold_depth = 0;
+
+/* Value of global s while compiling the body of fn, NULL if unbound or
+ ** bound by a frame. Adds the binding to pool, if any */
+static lval* lfold_global(lenv* top, lval* s, llambda* fn, lval* pool){
+    if(s->sym->frames || lvm_local(fn, s->sym)){
+        return NULL;
+    }
     
-    if(strstr(t->contents,".")){
-        v = lval_num(x, LVAL_DBL);
-    } else {
-        v = lval_num(x, LVAL_NUM);
+    int hint = 0;
+    lval* x = lenv_find(top, s->sym, &hint);
+    if(x && pool){
+        lval_add(pool, s);
+        lval_add(pool, x);
     }
+    return x;
+}
 
-    return errno != ERANGE ?  v : lval_err("invalid number");
+static lval* lfold_sexpr(lenv* top, lval* v, llambda* fn, lval* pool);
+
+/* Value of v if it is a number, a global bound to one or an expression
+ ** of those folding to one, NULL otherwise */
+static lval* lfold_value(lenv* top, lval* v, llambda* fn, lval* pool){
+    switch(v->type){
+        case LVAL_NUM:
+        case LVAL_BIG:
+        case LVAL_DBL:
+            return v;
+        case LVAL_SYM: {
+            lval* x = lfold_global(top, v, fn, pool);
+            return x && (lval_isint(x) || x->type == LVAL_DBL) ? x : NULL;
+        }
+        case LVAL_SEXPR:
+            return lfold_sexpr(top, v, fn, pool);
+    }
+    return NULL;
 }
 
-lval* lval_read_str(mpc_ast_t* t){
-    
-    /* Replace final quet with terminating char*/
-    t->contents[strlen(t->contents)-1] = '\0';
+/* Branch of (if c then else) taken for a constant c, otherwise NULL */
+static lval* lfold_branch(lenv* top, lval* v, llambda* fn, lval* pool){
+    if(v->count != 4 || lvm_form_index(v->cell[0]) != LFORM_IF){
+        return NULL;
+    }
     
-    /* Copy string without the leading quote */
-    char* unescaped = malloc(strlen(t->contents+1)+1);
-    strcpy(unescaped, t->contents+1);
+    lval* f = lfold_global(top, v->cell[0], fn, pool);
+    if(!f || f->type != LVAL_FORM || f->builtin != builtin_if){
+        return NULL;
+    }
     
-    /* Pass thru unescape function*/
-    unescaped = mpcf_unescape(unescaped);
+    lval* x = lfold_value(top, v->cell[1], fn, pool);
+    if(!x || !lval_isint(x)){
+        return NULL;
+    }
+    return v->cell[lval_truthy(x) ? 2 : 3];
+}
+
+static lval* lfold_cells(lenv* top, lval* v, llambda* fn, lval* pool){
+    if(v->count == 1){
+        return lfold_value(top, v->cell[0], fn, pool);
+    }
+    if(v->count < 2 || v->count > LFOLD_ARGS + 1){
+        return NULL;
+    }
     
-    lval* v = lval_str(unescaped);
+    lval* b = lfold_branch(top, v, fn, pool);
+    if(b){
+        return b->type == LVAL_QEXPR ? lfold_sexpr(top, b, fn, pool)
+                                     : lfold_value(top, b, fn, pool);
+    }
     
-    free(unescaped);
+    int p = lvm_prim_index(v->cell[0]);
+    if(p < 0){
+        return NULL;
+    }
+    lval* f = lfold_global(top, v->cell[0], fn, pool);
+    if(!f || f->type != LVAL_FUN || f->builtin != lvm_prim_funs[p]){
+        return NULL;
+    }
     
-    return v;
+    lval* args[LFOLD_ARGS];
+    for(int i = 1; i < v->count; i++){
+        args[i-1] = lfold_value(top, v->cell[i], fn, pool);
+        if(!args[i-1]){
+            return NULL;
+        }
+    }
     
+    lval* x = lvm_prim(p, args, v->count - 1);
+    return x && x->type != LVAL_ERR ? x : NULL;
 }
 
-/* Walks thru the mst tree and creates a S-Expr tree*/
-lval* lval_read(mpc_ast_t* t){
+/* Value of v's cells evaluated as an S-expression when they only apply
+ ** the arithmetic and comparison builtins, or take a branch of if, on
+ ** constants. NULL otherwise, and for errors, which are left to run */
+static lval* lfold_sexpr(lenv* top, lval* v, llambda* fn, lval* pool){
+    if(lfold_depth >= LFOLD_DEPTH){
+        return NULL;
+    }
+    lfold_depth++;
+    lval* x = lfold_cells(top, v, fn, pool);
+    lfold_depth--;
+    return x;
+}
+
+/* Cells evaluating like v's cells as an S-expression, with constant
+ ** parts replaced by their values under the current bindings */
+static lval* lfold_code(lenv* top, lval* v){
+    if(lval_too_deep(Heap->depth)){
+        return lval_copy(v);
+    }
     
-    // TODO: Add verbose
-        
-    if(strstr(t->tag, "number")){
-        return lval_read_num(t);
+    lval* x = lfold_sexpr(top, v, NULL, NULL);
+    if(x){
+        return lval_add(lval_sexpr(), x);
     }
     
-    if(strstr(t->tag, "symbol")){
-        return lval_sym(t->contents);
+    lval* b = lfold_branch(top, v, NULL, NULL);
+    if(b){
+        Heap->depth++;
+        x = lfold_code(top, b->type == LVAL_QEXPR ? b : lval_add(lval_sexpr(), b));
+        Heap->depth--;
+        return x;
     }
     
-    if(strstr(t->tag, "string")) {
-        return lval_read_str(t);
+    lval* r = lval_sexpr();
+    for(int i = 0; i < v->count; i++){
+        x = v->cell[i];
+        if(x->type == LVAL_SEXPR){
+            Heap->depth++;
+            x = lfold_code(top, x);
+            Heap->depth--;
+            x = x->count == 1 ? x->cell[0] : x;
+        }
+        lval_add(r, x);
     }
+    return r;
+}
+
+/* Show what the compiler folds in the code of a Q-Expression */
+lval* builtin_fold(lenv* e, lval* a){
+    LASSERT_ARGS("fold", a, 1);
+    LASSERT_TYPE("fold", a, 0, LVAL_QEXPR);
     
-    lval* x = NULL;
+    lval* x = lfold_code(e->top, a->cell[0]);
+    x->type = LVAL_QEXPR;
+    return x;
+}
+
+/* Compile flags, special forms in place and constant folding */
+enum { LVM_FORMS = 1, LVM_FOLD = 2 };
+
+static void lvm_compile_sexpr(lcode* c, lval* v, llambda* fn, int tail, int flags);
+
+/* Code pushing the value of v in the body of fn */
+static void lvm_compile_expr(lcode* c, lval* v, llambda* fn, int flags){
+    switch(v->type){
+        case LVAL_SYM:
+            if(lvm_local(fn, v->sym)){
+                lvm_emit(c, LOP_LOCAL);
+                lvm_emit(c, lvm_const(c, v));
+                lvm_emit(c, 0);
+            } else {
+                lvm_emit(c, LOP_GLOBAL);
+                lvm_emit(c, lvm_const(c, v));
+                lvm_emit(c, 0);
+                LVEC_PUSH(c->caches, c->ncaches, c->caches_cap, ((lcache){ 0, NULL, NULL }));
+                lvm_emit(c, c->ncaches - 1);
+            }
+            break;
+        case LVAL_SEXPR:
+            lvm_compile_sexpr(c, v, fn, 0, flags);
+            break;
+        default:
+            lvm_emit(c, LOP_CONST);
+            lvm_emit(c, lvm_const(c, v));
+            break;
+    }
+}
+
+/* Code for a branch of if, Q-Expressions run as S-expressions */
+static void lvm_compile_branch(lcode* c, lval* b, llambda* fn, int tail, int flags){
+    if(b->type == LVAL_SEXPR || b->type == LVAL_QEXPR){
+        lvm_compile_sexpr(c, b, fn, tail, flags);
+    } else {
+        lvm_compile_expr(c, b, fn, flags);
+    }
+}
+
+/* Emit a jump target to patch later, chained through the targets */
+static int lvm_chain(lcode* c, int chain){
+    lvm_emit(c, chain);
+    return c->nops - 1;
+}
+
+/* Check that the globals pooled since start still have the values they
+ ** were folded from, each at a cached slot. Returns the jump target to
+ ** patch for when not */
+static int lvm_guard(lcode* c, int start){
+    int n = (c->pool->count - start) / 2;
+    lvm_emit(c, LOP_GUARD);
+    lvm_emit(c, start);
+    lvm_emit(c, n);
+    LVEC_PUSH(c->caches, c->ncaches, c->caches_cap, ((lcache){ 0, NULL, NULL }));
+    lvm_emit(c, c->ncaches - 1);
+    int at = c->nops;
+    lvm_emit(c, 0);
+    for(int i = 0; i < n; i++){
+        lvm_emit(c, 0);
+    }
+    return at;
+}
+
+/* Drop the pool entries added since start */
+static void lvm_unpool(lcode* c, int start){
+    while(c->pool->count > start){
+        lval_pop(c->pool, c->pool->count - 1);
+    }
+}
+
+/* Code applying the function on the stack to the other cells of v */
+static void lvm_compile_call(lcode* c, lval* v, llambda* fn, int tail, int flags){
+    for(int i = 1; i < v->count; i++){
+        lvm_compile_expr(c, v->cell[i], fn, flags);
+    }
     
-    if(strstr(t->tag,"qexpr")){
-        x = lval_qexpr();
+    int p = lvm_prim_index(v->cell[0]);
+    if(p >= 0){
+        lvm_emit(c, LOP_PRIM);
+        lvm_emit(c, p);
+        lvm_emit(c, v->count - 1);
+    } else {
+        lvm_emit(c, tail ? LOP_TAIL : LOP_APPLY);
+        lvm_emit(c, v->count);
     }
+}
+
+static void lvm_compile_cells(lcode* c, lval* v, llambda* fn, int tail, int flags){
     
-    if(strcmp(t->tag, ">") == 0 || strstr(t->tag, "sexpr")){
-        x = lval_sexpr();
+    if(v->count == 1 && v->cell[0]->type == LVAL_SEXPR){
+        lvm_compile_sexpr(c, v->cell[0], fn, tail, flags);
+        return;
     }
     
+    if(v->count < 2){
+        for(int i = 0; i < v->count; i++){
+            lvm_compile_expr(c, v->cell[i], fn, flags);
+        }
+        lvm_emit(c, LOP_APPLY);
+        lvm_emit(c, v->count);
+        return;
+    }
     
-    /* Fill the list*/
-    for(int i = 0; i < t->children_num; i++){
-        if(strstr(t->children[i]->tag, "comment")) { continue; }
-        if(strcmp(t->children[i]->contents, "(") == 0) { continue; }
-        if(strcmp(t->children[i]->contents, ")") == 0) { continue; }
-        if(strcmp(t->children[i]->contents, "{") == 0) { continue; }
-        if(strcmp(t->children[i]->contents, "}") == 0) { continue; }
-        if(strcmp(t->children[i]->tag,  "regex") == 0) { continue; }
-        x = lval_add(x, lval_read(t->children[i]));
+    // Jumps to the end of the expression
+    int chain = -1;
+    
+    /* Constant expressions push their value while the globals they were
+     ** folded from keep theirs, and run as written otherwise */
+    if(flags & LVM_FOLD){
+        int start = c->pool->count;
+        lval* x = lfold_sexpr(c->top, v, fn, c->pool);
+        if(x){
+            int fallback = lvm_guard(c, start);
+            lval_add(c->pool, x);
+            lvm_emit(c, LOP_CONST);
+            lvm_emit(c, lvm_const(c, x));
+            lvm_emit(c, LOP_JUMP);
+            chain = lvm_chain(c, chain);
+            c->ops[fallback] = c->nops;
+            flags &= ~LVM_FOLD;
+        } else {
+            lvm_unpool(c, start);
+        }
     }
     
-    return x;
+    lval* h = v->cell[0];
+    int form = flags & LVM_FORMS ? lvm_form_index(h) : -1;
+    if((form == LFORM_IF && v->count != 4)
+       || (form == LFORM_DEF && (v->count != 3 || v->cell[1]->type != LVAL_SYM))){
+        form = -1;
+    }
     
-}
-
-lval* lval_eval(lenv* e, lval* v){
+    int fallback = 0;
     
-    // TODO: Add verbose
+    lvm_compile_expr(c, h, fn, flags);
+    if(h->type == LVAL_SYM || h->type == LVAL_SEXPR){
+        lvm_emit(c, LOP_HEAD);
+        lvm_emit(c, lvm_const(c, v));
+        lvm_emit(c, form);
+        fallback = c->nops;
+        lvm_emit(c, 0);
+        chain = lvm_chain(c, chain);
+    }
     
-    if(v->type == LVAL_SYM){
-        lval* x = lenv_get(e, v);
-        lval_del(v);
-        return x;
+    if(form == LFORM_IF){
+        /* (if c then else), only the branch taken when c is constant */
+        int full = flags;
+        int start = c->pool->count;
+        lval* b = flags & LVM_FOLD ? lfold_branch(c->top, v, fn, c->pool) : NULL;
+        if(b){
+            int other = lvm_guard(c, start);
+            lvm_compile_branch(c, b, fn, tail, flags);
+            lvm_emit(c, LOP_JUMP);
+            chain = lvm_chain(c, chain);
+            c->ops[other] = c->nops;
+            full &= ~LVM_FOLD;
+        } else if(flags & LVM_FOLD){
+            lvm_unpool(c, start);
+        }
+        
+        lvm_compile_expr(c, v->cell[1], fn, full);
+        lvm_emit(c, LOP_BRANCH);
+        int at = c->nops;
+        lvm_emit(c, 0);
+        chain = lvm_chain(c, chain);
+        
+        lvm_compile_branch(c, v->cell[2], fn, tail, full);
+        lvm_emit(c, LOP_JUMP);
+        chain = lvm_chain(c, chain);
+        c->ops[at] = c->nops;
+        lvm_compile_branch(c, v->cell[3], fn, tail, full);
+    } else if(form == LFORM_DEF){
+        /* (def x v) */
+        lvm_compile_expr(c, v->cell[2], fn, flags);
+        lvm_emit(c, LOP_DEF);
+        lvm_emit(c, lvm_const(c, v->cell[1]));
+    } else if(form >= 0){
+        /* (do ...), (and ...) and (or ...) stop early on their last operand */
+        int op = form == LFORM_DO ? LOP_SEQ : form == LFORM_AND ? LOP_AND : LOP_OR;
+        for(int i = 1; i < v->count; i++){
+            lval* x = v->cell[i];
+            int last = i == v->count - 1;
+            if(x->type == LVAL_SEXPR){
+                lvm_compile_sexpr(c, x, fn, tail && last, flags);
+            } else {
+                lvm_compile_expr(c, x, fn, flags);
+            }
+            if(!last){
+                lvm_emit(c, op);
+                chain = lvm_chain(c, chain);
+            }
+        }
+    } else {
+        lvm_compile_call(c, v, fn, tail, flags);
     }
     
-    // Evaluate S-expression
-    if( v->type == LVAL_SEXPR) {
-        return lval_eval_sexpr(e, v);
+    /* A form's name bound to a function is called like any other. Forms
+     ** are not inlined below, keeping the code linear in the size of v */
+    if(form >= 0){
+        lvm_emit(c, LOP_JUMP);
+        chain = lvm_chain(c, chain);
+        c->ops[fallback] = c->nops;
+        lvm_compile_call(c, v, fn, tail, flags & ~LVM_FORMS);
     }
     
-    return v;
+    while(chain >= 0){
+        int next = c->ops[chain];
+        c->ops[chain] = c->nops;
+        chain = next;
+    }
 }
 
-
-lval* lval_eval_sexpr(lenv* e, lval* v){
-    
-    // Evaluate children
-    for(int i = 0; i < v->count; i++){
-        v->cell[i] = lval_eval(e, v->cell[i]);
+/* Code pushing the value of v's cells evaluated as an S-expression,
+ ** calls to lambdas in tail position return to lval_call instead. Code
+ ** nested too deep is left to the tree walker, which bounds its own
+ ** depth */
+static void lvm_compile_sexpr(lcode* c, lval* v, llambda* fn, int tail, int flags){
+    if(lval_too_deep(c->depth)){
+        lvm_emit(c, LOP_EVAL);
+        lvm_emit(c, lvm_const(c, v));
+        return;
     }
     
-    // Check for Errors
-    for(int i = 0; i < v->count; i++){
-        if( v->cell[i]->type == LVAL_ERR) {
-            return lval_take(v, i);
+    c->depth++;
+    lvm_compile_cells(c, v, fn, tail, flags);
+    c->depth--;
+}
+
+/* Compile the cells of v as an S-expression against the bindings of e,
+ ** fn is the lambda run by lval_call that v is the body of, NULL for top
+ ** level code. The caller keeps the code's pool reachable */
+lcode* lvm_compile(lenv* e, lval* v, llambda* fn){
+    lcode* c = calloc(1, sizeof(lcode));
+    c->pool = lval_qexpr();
+    c->top = e->top;
+    lvm_compile_sexpr(c, v, fn, fn != NULL, LVM_FORMS | LVM_FOLD);
+    lvm_emit(c, LOP_RETURN);
+    return c;
+}
+
+void lcode_del(lcode* c){
+    free(c->ops);
+    free(c->consts);
+    free(c->caches);
+    free(c);
+}
+
+/* Result of primitive p on n values, NULL when the builtin has to be
+ ** called to report an error */
+static lval* lvm_prim(int p, lval** args, int n){
+    for(int i = 0; i < n; i++){
+        if(args[i]->type == LVAL_ERR){
+            return NULL;
         }
     }
     
-    // Empty expression
-    if( v->count == 0){
-        return v;
+    switch(p){
+        case LPRIM_ADD:
+        case LPRIM_SUB:
+        case LPRIM_MUL:
+        case LPRIM_DIV:
+            for(int i = 0; i < n; i++){
+                if(!lval_isint(args[i]) && args[i]->type != LVAL_DBL){
+                    return NULL;
+                }
+            }
+            return builtin_op_cells(p, args, n);
+        case LPRIM_LT:
+        case LPRIM_GT:
+        case LPRIM_LTE:
+        case LPRIM_GTE:
+            if(n != 2 || !lval_isint(args[0]) || !lval_isint(args[1])){
+                return NULL;
+            }
+            return lval_num(lprim_ord(p, lnum_cmp(args[0], args[1]), 0));
+        case LPRIM_EQ:
+        case LPRIM_NE:
+            if(n != 2){
+                return NULL;
+            }
+            return lval_num(lval_eq(args[0], args[1]) == (p == LPRIM_EQ));
     }
     
-    // Single expression
-    if( v->count == 1){
-        return lval_take(v, 0);
+    return NULL;
+}
+
+/* Replace the top n operands with the result of applying them */
+static void lvm_apply(lenv* e, int n){
+    lval* a = lval_sexpr();
+    lval_reserve(a, n);
+    for(int i = Heap->nroots - n; i < Heap->nroots; i++){
+        lval_add(a, Heap->roots[i]);
+    }
+    lgc_unroot(n);
+    lgc_root(lval_apply(e, a));
+}
+
+#ifdef __GNUC__
+#define LVM_NEXT() goto *lvm_labels[ops[pc++]]
+#else
+#define LVM_NEXT() goto dispatch
+#endif
+
+/* Run c in the enviorment e. Returns NULL after a tail call, leaving
+ ** the function and its arguments on the root stack */
+lval* lvm_run(lenv* e, lcode* c){
+    int* ops = c->ops;
+    lval** k = c->consts;
+    int base = Heap->nroots;
+    int pc = 0;
+    
+#ifdef __GNUC__
+    static void* lvm_labels[] = {
+        &&op_const, &&op_local, &&op_global, &&op_head, &&op_apply, &&op_tail, &&op_prim,
+        &&op_branch, &&op_seq, &&op_and, &&op_or, &&op_def, &&op_guard, &&op_jump,
+        &&op_eval, &&op_return
+    };
+#else
+dispatch:
+#endif
+    switch(ops[pc++]){
+        case LOP_CONST: op_const:
+            lgc_root(k[ops[pc++]]);
+            LVM_NEXT();
+            
+        case LOP_LOCAL: op_local: {
+            lval* s = k[ops[pc]];
+            lval* x = lenv_find(e, s->sym, &ops[pc+1]);
+            lgc_root(x ? x : lenv_get(e, s));
+            pc += 2;
+            LVM_NEXT();
+        }
+            
+        case LOP_GLOBAL: op_global: {
+            lval* s = k[ops[pc]];
+            lcache* ic = &c->caches[ops[pc+2]];
+            lval* x = NULL;
+            if(!s->sym->frames){
+                if(ic->version == Syms->version && ic->top == e->top){
+                    x = ic->val;
+                } else {
+                    x = lenv_find(e->top, s->sym, &ops[pc+1]);
+                    if(x){
+                        ic->version = Syms->version;
+                        ic->top = e->top;
+                        ic->val = x;
+                    }
+                }
+            }
+            lgc_root(x ? x : lenv_get(e, s));
+            pc += 3;
+            LVM_NEXT();
+        }
+            
+        case LOP_HEAD: op_head: {
+            lval* f = Heap->roots[Heap->nroots - 1];
+            int form = ops[pc+1];
+            if(form >= 0 && f->type == LVAL_FORM && f->builtin == lvm_form_funs[form]){
+                lgc_unroot(1);
+                pc += 4;
+            } else if(f->type != LVAL_FORM){
+                pc = form >= 0 ? ops[pc+2] : pc + 4;
+            } else {
+                lval* x = lval_eval_head(e, k[ops[pc]], f);
+                lgc_unroot(1);
+                lgc_root(x);
+                pc = ops[pc+3];
+            }
+            LVM_NEXT();
+        }
+            
+        case LOP_APPLY: op_apply: {
+            // Safe point, the operands are all on the root stack
+            if(Heap->nyoung >= Heap->next_gc){
+                lgc_collect();
+            }
+            lvm_apply(e, ops[pc++]);
+            LVM_NEXT();
+        }
+            
+        case LOP_TAIL: op_tail: {
+            if(Heap->nyoung >= Heap->next_gc){
+                lgc_collect();
+            }
+            int n = ops[pc++];
+            lval** cell = &Heap->roots[Heap->nroots - n];
+            
+            // Full applications of lambdas go back to lval_call
+            int tail = n >= 2 && cell[0]->type == LVAL_FUN && !cell[0]->builtin
+                && lval_saturates(cell[0]->lambda, n - 1);
+            for(int i = 0; tail && i < n; i++){
+                tail = cell[i]->type != LVAL_ERR;
+            }
+            if(!tail){
+                lvm_apply(e, n);
+                LVM_NEXT();
+            }
+            
+            lval* f = cell[0];
+            lval* a = lval_sexpr();
+            lval_reserve(a, n - 1);
+            for(int i = 1; i < n; i++){
+                lval_add(a, cell[i]);
+            }
+            lgc_unroot(Heap->nroots - base);
+            lgc_root(f);
+            lgc_root(a);
+            return NULL;
+        }
+            
+        case LOP_PRIM: op_prim: {
+            if(Heap->nyoung >= Heap->next_gc){
+                lgc_collect();
+            }
+            int p = ops[pc++];
+            int n = ops[pc++];
+            lval** args = &Heap->roots[Heap->nroots - n];
+            lval* f = args[-1];
+            lval* x = NULL;
+            if(f->type == LVAL_FUN && f->builtin == lvm_prim_funs[p]){
+                x = lvm_prim(p, args, n);
+            }
+            if(x){
+                lgc_unroot(n + 1);
+                lgc_root(x);
+            } else {
+                lvm_apply(e, n + 1);
+            }
+            LVM_NEXT();
+        }
+            
+        case LOP_BRANCH: op_branch: {
+            lval* x = Heap->roots[Heap->nroots - 1];
+            if(x->type == LVAL_NUM || x->type == LVAL_BIG){
+                lgc_unroot(1);
+                pc = x->type == LVAL_BIG || x->num ? pc + 2 : ops[pc];
+            } else {
+                lval* err = lval_cond_err(x);
+                if(err){
+                    lgc_unroot(1);
+                    lgc_root(err);
+                }
+                pc = ops[pc+1];
+            }
+            LVM_NEXT();
+        }
+            
+        case LOP_SEQ: op_seq: {
+            lval* x = Heap->roots[Heap->nroots - 1];
+            if(x->type == LVAL_ERR){
+                pc = ops[pc];
+            } else {
+                lgc_unroot(1);
+                pc++;
+            }
+            LVM_NEXT();
+        }
+            
+        case LOP_AND: op_and: {
+            lval* x = Heap->roots[Heap->nroots - 1];
+            if(x->type == LVAL_ERR || !lval_truthy(x)){
+                pc = ops[pc];
+            } else {
+                lgc_unroot(1);
+                pc++;
+            }
+            LVM_NEXT();
+        }
+            
+        case LOP_OR: op_or: {
+            lval* x = Heap->roots[Heap->nroots - 1];
+            if(x->type == LVAL_ERR || lval_truthy(x)){
+                pc = ops[pc];
+            } else {
+                lgc_unroot(1);
+                pc++;
+            }
+            LVM_NEXT();
+        }
+            
+        case LOP_DEF: op_def: {
+            lval* x = Heap->roots[Heap->nroots - 1];
+            if(x->type != LVAL_ERR){
+                lenv_def(e, k[ops[pc]], x);
+                lgc_unroot(1);
+                lgc_root(lval_sexpr());
+            }
+            pc++;
+            LVM_NEXT();
+        }
+            
+        case LOP_GUARD: op_guard: {
+            lval** g = &c->pool->cell[ops[pc]];
+            int n = ops[pc+1];
+            lcache* ic = &c->caches[ops[pc+2]];
+            int ok = 1;
+            for(int i = 0; i < n; i++){
+                ok = ok && !g[2*i]->sym->frames;
+            }
+            if(ok && (ic->version != Syms->version || ic->top != e->top)){
+                for(int i = 0; ok && i < n; i++){
+                    ok = lenv_find(e->top, g[2*i]->sym, &ops[pc+4+i]) == g[2*i+1];
+                }
+                if(ok){
+                    ic->version = Syms->version;
+                    ic->top = e->top;
+                }
+            }
+            pc = ok ? pc + 4 + n : ops[pc+3];
+            LVM_NEXT();
+        }
+            
+        case LOP_JUMP: op_jump:
+            pc = ops[pc];
+            LVM_NEXT();
+            
+        case LOP_EVAL: op_eval:
+            lgc_root(lval_eval_sexpr(e, k[ops[pc++]]));
+            LVM_NEXT();
+            
+        case LOP_RETURN: op_return: {
+            lval* x = Heap->roots[Heap->nroots - 1];
+            lgc_unroot(Heap->nroots - base);
+            return x;
+        }
     }
     
-    // Ensure first elemnt is a function
-    lval* f = lval_pop(v, 0);
-    if(f->type != LVAL_FUN){
-        lval* err = lval_err("S-Expression starts with incorrect type. Got %s, Expexted %s",
-                             ltype_name(f->type),ltype_name(LVAL_FUN));
-        lval_del(v);
-        lval_del(f);
-        return err;
+    return NULL;
+}
+
+/* Evaluate v, running S-expressions through the VM */
+lval* lval_exec(lenv* e, lval* v){
+#ifdef BLISP_NO_VM
+    return lval_eval(e, v);
+#else
+    if(v->type != LVAL_SEXPR){
+        return lval_eval(e, v);
     }
     
-    // Call to function
-    lval* result = lval_call(e, f, v);
-    lval_del(f);
-    return result;
+    lgc_root(v);
+    lcode* c = lvm_compile(e, v, NULL);
+    lgc_root(c->pool);
+    lval* x = lvm_run(e, c);
+    lcode_del(c);
+    lgc_unroot(2);
+    return x;
+#endif
 }
 
 
@@ -1115,7 +5086,7 @@ lval* ltype_check(char* func, lval* a, int expect){
         LASSERT_TYPE(func, a, i, expect);
     }
     
-    return lval_num(1, LVAL_NUM);
+    return lval_num(1);
 }
 
 char* ltype_name(int t){
@@ -1123,8 +5094,13 @@ char* ltype_name(int t){
         case LVAL_QEXPR: return "Q-Expression";
         case LVAL_SEXPR: return "S-Expression";
         case LVAL_NUM:   return "Number";
+        case LVAL_BIG:   return "Number";
+        case LVAL_DBL:   return "Double";
+        case LVAL_VEC:   return "Vector";
+        case LVAL_MAT:   return "Matrix";
         case LVAL_SYM:   return "Symbole";
         case LVAL_FUN:   return "Function";
+        case LVAL_FORM:  return "Special Form";
         case LVAL_ERR:   return "Error";
         case LVAL_STR:   return "String";
         default: return "Unknown";
@@ -1137,9 +5113,14 @@ void lenv_add_builtin(lenv* e, char* name, lbuiltin func){
     lval* k = lval_sym(name);
     lval* v = lval_fun(func);
     lenv_put(e, k ,v);
+}
+
+/* Add single special form to enviorment */
+void lenv_add_form(lenv* e, char* name, lbuiltin func){
     
-    lval_del(k);
-    lval_del(v);
+    lval* k = lval_sym(name);
+    lval* v = lval_form(func);
+    lenv_put(e, k ,v);
 }
 
 /* Register all builtin function to the global enviorment */
@@ -1147,8 +5128,17 @@ void lenv_add_builtins(lenv* e){
     
     lenv_add_builtin(e, "print", builtin_print);
     lenv_add_builtin(e, "error", builtin_error);
-    
-    lenv_add_builtin(e, "if", builtin_if);
+    lenv_add_builtin(e, "mem", builtin_mem);
+    lenv_add_builtin(e, "gc-budget", builtin_gc_budget);
+    lenv_add_builtin(e, "max-depth", builtin_max_depth);
+    
+    lenv_add_form(e, "if", builtin_if);
+    lenv_add_form(e, "do", builtin_do);
+    lenv_add_form(e, "and", builtin_and);
+    lenv_add_form(e, "or", builtin_or);
+    lenv_add_form(e, "while", builtin_while);
+    lenv_add_form(e, "dotimes", builtin_dotimes);
+    lenv_add_form(e, "for-each", builtin_for_each);
     lenv_add_builtin(e, ">", builtin_gt);
     lenv_add_builtin(e, "<", builtin_lt);
     lenv_add_builtin(e, ">=", builtin_gte);
@@ -1157,40 +5147,66 @@ void lenv_add_builtins(lenv* e){
     lenv_add_builtin(e, "!=", builtin_ne);
     
     lenv_add_builtin(e, "\\", builtin_lambda);
-    lenv_add_builtin(e, "def", builtin_def);
+    lenv_add_form(e, "fn", builtin_fn);
+    lenv_add_form(e, "lambda", builtin_fn);
+    lenv_add_form(e, "let", builtin_let);
+    lenv_add_form(e, "def", builtin_def);
     lenv_add_builtin(e, "=", builtin_put);
     
     lenv_add_builtin(e, "list", builtin_list);
     lenv_add_builtin(e, "head", builtin_head);
     lenv_add_builtin(e, "tail", builtin_tail);
     lenv_add_builtin(e, "eval", builtin_eval);
+    lenv_add_builtin(e, "fold", builtin_fold);
     lenv_add_builtin(e, "join", builtin_join);
     
     lenv_add_builtin(e, "+", builtin_add);
     lenv_add_builtin(e, "-", builtin_sub);
     lenv_add_builtin(e, "*", builtin_mul);
     lenv_add_builtin(e, "/", builtin_div);
+    
+    lenv_add_builtin(e, "vec", builtin_vec);
+    lenv_add_builtin(e, "vec-list", builtin_vec_list);
+    lenv_add_builtin(e, "vec-range", builtin_vec_range);
+    lenv_add_builtin(e, "vec-len", builtin_vec_len);
+    lenv_add_builtin(e, "sum", builtin_sum);
+    lenv_add_builtin(e, "dot", builtin_dot);
+    lenv_add_builtin(e, "min", builtin_min);
+    lenv_add_builtin(e, "max", builtin_max);
+    lenv_add_builtin(e, "mat", builtin_mat);
+    lenv_add_builtin(e, "mat-list", builtin_mat_list);
+    lenv_add_builtin(e, "reshape", builtin_reshape);
+    lenv_add_builtin(e, "shape", builtin_shape);
+    lenv_add_builtin(e, "transpose", builtin_transpose);
+    lenv_add_builtin(e, "matmul", builtin_matmul);
 }
 
 void run_REPL(void){
-     /* Build enviorment*/
+     /* Build allocator and enviorment*/
+    Alloc = lalloc_new();
+    Heap = lheap_new();
+    Syms = lsymtab_new();
+    Syms->rest = lsym_intern("&");
     lenv* e = lenv_new();
     lenv_add_builtins(e);
+    lgc_root_env(e);
 
     while(1) {
         char* input = readline("blisp> ");
         add_history(input);
         
-        /* Parse user input */
+        /* Parse user input, unless it nests too deep to evaluate */
         mpc_result_t r;
-        if(mpc_parse("<stdin>", input, Blisp, &r)) {
+        lval* deep = lval_read_depth(input);
+        if(deep){
+            lval_println(deep);
+        } else if(mpc_parse("<stdin>", input, Blisp, &r)) {
              
-            lval* result = lval_eval(e, lval_read(r.output));
+            lval* result = lval_exec(e, lval_read(r.output));
             //TODO: Add verdose mpc_ast_print(r.output);
             lval_println(result);
-            lval_del(result);
             
-            mpc_ast_delete(r.output);
+            lval_read_del(r.output);
         } else {
             mpc_err_print(r.error);
             mpc_err_delete(r.error);
@@ -1199,14 +5215,23 @@ void run_REPL(void){
         free(input);
     }  
 
-    /* Clean enviorment */
+    /* Clean enviorment and allocator */
+    lgc_unroot_env();
     lenv_del(e);  
+    lheap_del(Heap);
+    lsymtab_del(Syms);
+    lalloc_del(Alloc);
 }
 
 void run_FILE(int argc,char** argv){
-    /* Build enviorment*/
+    /* Build allocator and enviorment*/
+    Alloc = lalloc_new();
+    Heap = lheap_new();
+    Syms = lsymtab_new();
+    Syms->rest = lsym_intern("&");
     lenv* e = lenv_new();
     lenv_add_builtins(e);
+    lgc_root_env(e);
 
     /* Loop thru suplid filenames */
     for(int i = 1; i < argc; i++){
@@ -1220,11 +5245,14 @@ void run_FILE(int argc,char** argv){
         if(x->type == LVAL_ERR) {
             lval_println(x);
         }
-        lval_del(x);
     } 
 
-    /* Clean enviorment */
+    /* Clean enviorment and allocator */
+    lgc_unroot_env();
     lenv_del(e);     
+    lheap_del(Heap);
+    lsymtab_del(Syms);
+    lalloc_del(Alloc);
 }
 
 int main(int argc,char** argv){
@@ -1233,6 +5261,7 @@ int main(int argc,char** argv){
     
     /* Define language */
     define_lang();
+    lvec_init();
     
     
     
@@ -3,13 +3,25 @@
 #ifndef blisp_h
 #define blisp_h
 
+#include <stdint.h>
+
 /*
  ** Types
  */
 struct lval;
 struct lenv;
+struct llambda;
+struct lcells;
+struct lbig;
+struct lcode;
+struct lsym;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct llambda llambda;
+typedef struct lcells lcells;
+typedef struct lbig lbig;
+typedef struct lcode lcode;
+typedef struct lsym lsym;
 
 
 
@@ -17,32 +29,258 @@ typedef struct lenv lenv;
 typedef lval*(*lbuiltin)(lenv*, lval*);
 
 struct lval {
-    int type;
+    unsigned char type;
+    
+    /* Set while the collector has reached this value */
+    unsigned char mark;
     
-    /* Number , Error and Symbol*/
-    double num;
-    char* err;
-    char* sym;
-    char* str;
+    /* Set once the value survived a collection */
+    unsigned char old;
     
+    /* Number of cells of an S-Expression or Q-Expression, or of numbers
+     ** of a Vector or Matrix */
+    int count;
     
-    lbuiltin builtin;
+    /* Payload, only the member matching type is valid */
+    union {
+        /* Integer, bignum and double */
+        int64_t num;
+        lbig* big;
+        double dbl;
+        
+        /* Vector, its length is count, and row-major Matrix */
+        struct {
+            double* vec;
+            int rows;
+            int cols;
+        };
+        
+        /* Error and String */
+        char* err;
+        char* str;
+        
+        /* Symbol */
+        lsym* sym;
+        
+        /* Function and special form, lambdas keep their state out of line */
+        struct {
+            lbuiltin builtin;
+            llambda* lambda;
+        };
+        
+        /* S-Expression and Q-Expression, cell points into buf */
+        struct {
+            lval** cell;
+            lcells* buf;
+        };
+    };
+};
+
+/* Cell buffer, shared by the lists copied from the one that built it */
+struct lcells {
+    int refs;
+    int cap;
+    lval* items[];
+};
+
+/* Integer beyond int64, magnitude in base 2^32 limbs, least significant
+ ** first without leading zeros. Zero has no limbs and a positive sign */
+struct lbig {
+    int sign;
+    int count;
+    int cap;
+    uint32_t limbs[];
+};
+
+struct llambda {
     lenv* env;
     lval* formals;
     lval* body;
     
+    /* Fixed formals before '&' and whether a rest formal follows. arity
+     ** is -1 when binding needs the checks in lval_bind: a misplaced '&',
+     ** repeated formals or formals already bound in env */
+    int arity;
+    int variadic;
     
-    int count;
-    lval** cell;
+    /* Body compiled on the first full call */
+    lcode* code;
+};
+
+/* Inline cache of a global lookup, valid while the top level bindings
+ ** are at version */
+typedef struct lcache {
+    long version;
+    lenv* top;
+    lval* val;
+} lcache;
+
+/* Bytecode of an S-expression, constants point into its source */
+struct lcode {
+    int* ops;
+    int nops;
+    int ops_cap;
+    
+    lval** consts;
+    int nconsts;
+    int consts_cap;
+    
+    lcache* caches;
+    int ncaches;
+    int caches_cap;
+    
+    /* Values the code holds besides its source: folded constants, and
+     ** the globals they were folded from as pairs of symbol and value */
+    lval* pool;
     
+    /* Top level enviorment the code was compiled against */
+    lenv* top;
+    
+    /* Nesting of the S-Expression being compiled */
+    int depth;
 };
 
+/* Size class free list, objects are carved out of malloc'd chunks */
+typedef struct lslab {
+    size_t size;
+    void* free;
+    void* chunks;
+    
+    /* Allocations served from the free list, and those that were not */
+    long hits;
+    long misses;
+} lslab;
+
+/* Cell buffers up to (2 << (LSLAB_CELL_CLASSES-1)) - 1 slots are slab allocated */
+#define LSLAB_CELL_CLASSES 6
+
+/* Allocator state of an interpreter */
+typedef struct lalloc {
+    lslab lvals;
+    lslab envs;
+    lslab cells[LSLAB_CELL_CLASSES];
+} lalloc;
+
+/* Interned symbol, one per distinct name */
+struct lsym {
+    char* name;
+    
+    /* Active frames binding the name, while there are none lookups go
+     ** straight to the top level enviorment */
+    int frames;
+};
+
+/* Interned symbols by name */
+typedef struct lsymtab {
+    /* Open addressing table, free slots are NULL */
+    lsym** syms;
+    int count;
+    int cap;
+    
+    /* The variadic argument marker "&" */
+    lsym* rest;
+    
+    /* Bumped by every change to a top level enviorment binding */
+    long version;
+} lsymtab;
+
+/* Number of recent collector pauses kept for statistics */
+#define LGC_PAUSES 4096
+
+/* Garbage collected heap, every lval is registered in one generation */
+typedef struct lheap {
+    /* Values allocated since the last minor collection */
+    lval** young;
+    int nyoung;
+    int young_cap;
+    
+    /* Values that survived a minor collection */
+    lval** old;
+    int nold;
+    int old_cap;
+    
+    /* Young values stored into old values or the global enviorment */
+    lval** remembered;
+    int nremembered;
+    int remembered_cap;
+    
+    /* Run the safe point collector once nyoung reaches next_gc,
+     ** minor collections run once it reaches nursery */
+    int next_gc;
+    int nursery;
+    
+    /* Start marking the old generation once nold reaches next_major */
+    int next_major;
+    long minors;
+    long majors;
+    
+    /* Incremental major collection, see lgc_step */
+    int phase;
+    long budget;
+    lval** mgray;
+    int nmgray;
+    int mgray_cap;
+    lenv** pending;
+    int npending;
+    int pending_cap;
+    int scan;
+    int sweep;
+    int swept;
+    
+    /* Pause times in microseconds */
+    long pauses[LGC_PAUSES];
+    long npauses;
+    long max_pause;
+    double seconds;
+    
+    /* Temporaries and environments the evaluator is holding on to */
+    lval** roots;
+    int nroots;
+    int roots_cap;
+    lenv** envs;
+    int nenvs;
+    int envs_cap;
+    
+    /* Nested evaluations on the C stack, deeper ones are an error, as
+     ** are ones using more than stack_max bytes of it above stack */
+    int depth;
+    int max_depth;
+    uintptr_t stack;
+    long stack_max;
+    
+    /* Roots below these only held old values at the last minor */
+    int roots_clean;
+    int envs_clean;
+    
+    /* Marked young values whose children are still to be marked */
+    lval** gray;
+    int ngray;
+    int gray_cap;
+    
+    /* Bytes young and old values hold out of line, see lval_bytes */
+    long young_bytes;
+    long old_bytes;
+} lheap;
+
+/* Frames up to LENV_INLINE bindings keep them in place */
+#define LENV_INLINE 8
+
 struct lenv{
     lenv* par;
     
+    /* Top level enviorment at the end of the parent chain */
+    lenv* top;
+    
+    /* Bindings are scanned in order while cap is LENV_INLINE, larger
+     ** enviorments are open addressing tables keyed by the interned symbol.
+     ** Free slots have a NULL symbol */
     int count;
-    char** syms;
+    int cap;
+    lsym** syms;
     lval** vals;
+    
+    lsym* inline_syms[LENV_INLINE];
+    lval* inline_vals[LENV_INLINE];
 };
 
 /*
@@ -57,60 +295,150 @@ mpc_parser_t* Qexpr;
 mpc_parser_t* Expr;
 mpc_parser_t* Blisp;
 
+lalloc* Alloc;
+lheap* Heap;
+lsymtab* Syms;
+
 /*
  ** Function Declaration
  */
+lalloc* lalloc_new(void);
+void    lalloc_del(lalloc* a);
+void*   lslab_alloc(lslab* s);
+void    lslab_free(lslab* s, void* p);
+lcells* lcells_new(int n);
+void    lcells_release(lcells* b);
+lbig*   lbig_new(int n);
+void    lbig_del(lbig* b);
+lbig*   lbig_from_int(int64_t x);
+int     lbig_int(lbig* b, int64_t* x);
+double  lbig_dbl(lbig* b);
+double  lbig_ratio(lbig* a, lbig* b);
+int     lbig_cmp(lbig* a, lbig* b);
+lbig*   lbig_add(lbig* a, lbig* b, int sub);
+lbig*   lbig_mul(lbig* a, lbig* b);
+lbig*   lbig_div(lbig* a, lbig* b, lbig** r);
+int     lbig_strlen(lbig* b);
+void    lbig_str(lbig* b, char* s);
+lbig*   lbig_read(const char* s);
+void    lvec_init(void);
+
+lsymtab* lsymtab_new(void);
+void     lsymtab_del(lsymtab* t);
+lsym*    lsym_intern(char* s);
+
+lheap* lheap_new(void);
+void   lheap_del(lheap* h);
+void   lgc_root(lval* v);
+void   lgc_unroot(int n);
+void   lgc_root_env(lenv* e);
+void   lgc_unroot_env(void);
+void   lgc_remember(lval* v);
+void   lgc_shade(lval* v);
+void   lgc_collect(void);
+long   lgc_pause_pct(double pct);
+
 lenv* lenv_new(void);
 void  lenv_del(lenv* e);
 lval* lenv_get(lenv* e, lval* k);
 void  lenv_put(lenv* e, lval* k, lval* v);
 void  lenv_def(lenv* e, lval* k, lval* v);
 lenv* lenv_copy(lenv* e);
+lenv* lenv_frame(lenv* e, lenv* par);
+void  lenv_detach(lenv* e);
+void  lenv_push(lenv* e, lsym* k, lval* v);
+lval* lenv_find(lenv* e, lsym* k, int* hint);
 
-lval* lval_num(double x, int type);
+lval* lval_num(int64_t x);
+lval* lval_dbl(double x);
+lval* lval_big(lbig* b);
+lval* lval_vec(long n);
+lval* lval_mat(int rows, int cols);
+lval* lval_vec_op(int op, lval** cell, int n);
 lval* lval_err(char* fmt, ...);
 lval* lval_sym(char* s);
 lval* lval_sexpr(void);
 lval* lval_str(char* s);
+lval* lval_form(lbuiltin func);
 
 
 lval* lval_read_num(mpc_ast_t* t);
 lval* lval_read_str(mpc_ast_t* t);
 lval* lval_read(mpc_ast_t* t);
+lval* lval_read_depth(char* s);
+void  lval_read_del(mpc_ast_t* t);
 
 
 lval* lval_eval_sexpr(lenv* e, lval* v);
+lval* lval_eval_head(lenv* e, lval* v, lval* f);
+lval* lval_apply(lenv* e, lval* a);
+lval* lval_call(lenv* e, lval* f, lval* a);
+int   lval_saturates(llambda* l, int given);
 lval* lval_eval(lenv* e, lval* v);
 
+lcode* lvm_compile(lenv* e, lval* v, llambda* fn);
+void   lcode_del(lcode* c);
+lval*  lvm_run(lenv* e, lcode* c);
+lval*  lval_exec(lenv* e, lval* v);
+
 lval* lval_pop(lval* v, int i);
-lval* lval_take(lval* v, int i);
 lval* lval_join(lval* x, lval* y);
 lval* lval_copy(lval* v);
-void  lval_del(lval* v);
 lval* lval_add(lval* v, lval* x);
+void  lval_reserve(lval* v, int n);
 
 int   lval_eq(lval* x, lval* y);
+int   lval_truthy(lval* v);
+lval* lval_cond_err(lval* c);
 
 void  lval_print(lval* v);
 void  lval_println(lval* v);
 void  lval_expr_print(lval* v, char open, char close);
 void  lval_print_str(lval* v);
 
-lval* builtin_op(lenv* e, lval* a, char* op);
+lval* builtin_op(lenv* e, lval* a, int op);
+lval* builtin_op_cells(int op, lval** cell, int n);
 lval* builtin_head(lenv* e, lval* a);
 lval* builtin_tail(lenv* e, lval* a);
 lval* builtin_list(lenv* e, lval* a);
 lval* builtin_eval(lenv* e, lval* a);
+lval* builtin_fold(lenv* e, lval* a);
 lval* builtin_join(lenv* e, lval* a);
 lval* builtin(lval* a, char* func);
 lval* builtin_def(lenv* e, lval* a);
+lval* builtin_fn(lenv* e, lval* a);
+lval* builtin_let(lenv* e, lval* a);
+lval* builtin_do(lenv* e, lval* a);
+lval* builtin_and(lenv* e, lval* a);
+lval* builtin_or(lenv* e, lval* a);
+lval* builtin_while(lenv* e, lval* a);
+lval* builtin_dotimes(lenv* e, lval* a);
+lval* builtin_for_each(lenv* e, lval* a);
 lval* builtin_put(lenv* e, lval* a);
 lval* builtin_print(lenv* e, lval* a);
 lval* builtin_error(lenv* e, lval* a);
+lval* builtin_mem(lenv* e, lval* a);
+lval* builtin_gc_budget(lenv* e, lval* a);
+lval* builtin_max_depth(lenv* e, lval* a);
 
-lval* builtin_cmp(lenv* e, lval* a, char* op);
+lval* builtin_ord(lenv* e, lval* a, int op);
+lval* builtin_vec(lenv* e, lval* a);
+lval* builtin_vec_list(lenv* e, lval* a);
+lval* builtin_vec_range(lenv* e, lval* a);
+lval* builtin_vec_len(lenv* e, lval* a);
+lval* builtin_sum(lenv* e, lval* a);
+lval* builtin_dot(lenv* e, lval* a);
+lval* builtin_extreme(lenv* e, lval* a, char* func, int max);
+lval* builtin_min(lenv* e, lval* a);
+lval* builtin_max(lenv* e, lval* a);
+lval* builtin_mat(lenv* e, lval* a);
+lval* builtin_mat_list(lenv* e, lval* a);
+lval* builtin_reshape(lenv* e, lval* a);
+lval* builtin_shape(lenv* e, lval* a);
+lval* builtin_transpose(lenv* e, lval* a);
+lval* builtin_matmul(lenv* e, lval* a);
+lval* builtin_cmp(lenv* e, lval* a, int op);
 lval* builtin_var(lenv* e, lval* a, char* func);
-double builtin_op_helper(char* op, double x, double y);
 
 lval* builtin_load(lenv* e, lval* a);
 
@@ -123,9 +451,7 @@ lval* ltype_check(char* func, lval* a, int expect);
  */
 #define LASSERT(args, cond, fmt, ...)  \
 if(!(cond)) {  \
-lval* err = lval_err(fmt, ##__VA_ARGS__); \
-lval_del(args); \
-return err; \
+return lval_err(fmt, ##__VA_ARGS__); \
 }
 
 #define LASSERT_TYPE(func, args, index, expect) \
@@ -134,6 +460,11 @@ LASSERT(args,(args->cell[index]->type == expect), \
 func, index, ltype_name(args->cell[index]->type), ltype_name(expect))
 
 
+#define LASSERT_ARR(func, args, index) \
+LASSERT(args, (args->cell[index]->type == LVAL_VEC || args->cell[index]->type == LVAL_MAT), \
+"Function '%s' passed incorrect types for argument %i. Got %s, Expected %s or %s", \
+func, index, ltype_name(args->cell[index]->type), ltype_name(LVAL_VEC), ltype_name(LVAL_MAT))
+
 #define LASSERT_ARGS(op, args, expect) \
 LASSERT(args, (args->count == expect), \
 "Function '%s' passed wrong number of arguments, Got %i, Expected %i", \